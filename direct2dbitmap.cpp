@@ -1,4 +1,6 @@
 #include "direct2dbitmap.h"
+#include <algorithm>
+#include <cstring>
 #include "direct2dwidget.h"
 #include "src/direct2d/direct2dqthelper.h"
 int Direct2DBitmap::metric(PaintDeviceMetric metric) const
@@ -8,18 +10,18 @@ int Direct2DBitmap::metric(PaintDeviceMetric metric) const
 
 	switch (metric) {
 	case QPaintDevice::PdmWidth:
-		return (int)m_context->GetPixelSize().width;
+		return (int)m_width;
 	case QPaintDevice::PdmHeight:
-		return (int)m_context->GetPixelSize().height;
+		return (int)m_height;
 	case QPaintDevice::PdmWidthMM: {
 		FLOAT dpix, dpiy;
 		m_context->GetDpi(&dpix, &dpiy);
-		return (int)((m_context->GetPixelSize().width * 25.4) / dpix);
+		return (int)((m_width * 25.4) / dpix);
 	}
 	case QPaintDevice::PdmHeightMM: {
 		FLOAT dpix, dpiy;
 		m_context->GetDpi(&dpix, &dpiy);
-		return (int)((m_context->GetPixelSize().height * 25.4) / dpiy);
+		return (int)((m_height * 25.4) / dpiy);
 	}
 	case QPaintDevice::PdmNumColors: {
 		return INT_MAX;
@@ -48,29 +50,25 @@ int Direct2DBitmap::metric(PaintDeviceMetric metric) const
 	return -1;
 }
 
-Direct2DBitmap::Direct2DBitmap() : m_dpiX(96.0f), m_dpiY(96.0f), m_width(100), m_height(100), m_initiated(false) {}
+Direct2DBitmap::Direct2DBitmap() : m_exactSize(false), m_dpiX(96.0f), m_dpiY(96.0f), m_width(100), m_height(100), m_initiated(false), m_readbackSequence(0) {}
+
+Direct2DBitmap::~Direct2DBitmap()
+{
+	dropReadbacks();
+	releaseBitmap();
+}
 
 bool Direct2DBitmap::resize(UINT32 width, UINT32 height)
 {
 	m_width = width;
 	m_height = height;
 	if (ensureInit()) {
-		m_context->SetTarget(nullptr);
-		m_bitmap.Reset();
-
-		D2D1_SIZE_U size = { UINT32(m_width), UINT32(m_height) };
-
-		HRESULT hr = m_context->CreateBitmap(size,
-			nullptr,
-			0,
-			bitmapProperties(),
-			m_bitmap.ReleaseAndGetAddressOf());
-		if (SUCCEEDED(hr))
-			m_context->SetTarget(m_bitmap.Get());
-		else
-			qWarning("%s: Could not create bitmap: %#lx", __FUNCTION__, hr);
-
-		return SUCCEEDED(hr);
+		// small size changes stay inside the bucket and only move the viewport
+		const D2D1_SIZE_U allocated = m_bitmap ? m_bitmap->GetPixelSize() : D2D1_SIZE_U{};
+		const D2D1_SIZE_U wanted = allocationSize();
+		if (allocated.width == wanted.width && allocated.height == wanted.height)
+			return true;
+		return acquireBitmap();
 	}
 	return false;
 }
@@ -82,55 +80,129 @@ bool Direct2DBitmap::changeDpi(FLOAT dpiX, FLOAT dpiY)
 	if (ensureInit()) {
 		m_context->SetTarget(nullptr);
 		m_context->SetDpi(m_dpiX, m_dpiY);
-		D2D1_SIZE_U size = { UINT32(m_bitmap->GetSize().width), UINT32(m_bitmap->GetSize().height) };
-		m_bitmap.Reset();
-
-		HRESULT hr = m_context->CreateBitmap(size,
-			nullptr,
-			0,
-			bitmapProperties(),
-			m_bitmap.ReleaseAndGetAddressOf());
-		if (SUCCEEDED(hr))
-			m_context->SetTarget(m_bitmap.Get());
-		else
-			qWarning("%s: Could not create bitmap: %#lx", __FUNCTION__, hr);
-
-		return SUCCEEDED(hr);
+		return acquireBitmap();
 	}
 	return false;
 }
 
 bool Direct2DBitmap::init(UINT32 width, UINT32 height, FLOAT dpiX, FLOAT dpiY)
 {
-	HRESULT hr = DirectContext::instance().d2dDevice()->CreateDeviceContext(
-		D2D1_DEVICE_CONTEXT_OPTIONS_ENABLE_MULTITHREADED_OPTIMIZATIONS,
-		m_context.ReleaseAndGetAddressOf());
-	if (SUCCEEDED(hr)) {
+	HRESULT hr = S_OK;
+	// the device context only depends on the device, keep it across re-initializations
+	if (!m_context) {
+		hr = DirectContext::instance().d2dDevice()->CreateDeviceContext(
+			D2D1_DEVICE_CONTEXT_OPTIONS_ENABLE_MULTITHREADED_OPTIMIZATIONS,
+			m_context.ReleaseAndGetAddressOf());
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create device context: %#lx", __FUNCTION__, hr);
+			m_initiated = false;
+			return false;
+		}
 		m_context->SetAntialiasMode(D2D1_ANTIALIAS_MODE_ALIASED);
 		m_context->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_CLEARTYPE);
 		m_context->SetUnitMode(D2D1_UNIT_MODE_PIXELS);
-		if (SUCCEEDED(hr)) {
-			engine.reset(new Direct2DPaintEngine(this));
-			D2D1_SIZE_U size = { width, height };
-			m_dpiX = dpiX;
-			m_dpiY = dpiY;
-			hr = m_context->CreateBitmap(size,
-				nullptr,
-				0,
-				bitmapProperties(),
-				m_bitmap.ReleaseAndGetAddressOf());
-
-			if (SUCCEEDED(hr))
-				m_context->SetTarget(m_bitmap.Get());
-			else
-				qWarning("%s: Could not create bitmap: %#lx", __FUNCTION__, hr);
+	}
+	if (!engine)
+		engine.reset(new Direct2DPaintEngine(this));
+
+	m_width = width;
+	m_height = height;
+	m_dpiX = dpiX;
+	m_dpiY = dpiY;
+	m_initiated = acquireBitmap();
+	return m_initiated;
+}
+
+ID2D1Bitmap1* Direct2DBitmap::bitmap()
+{
+	if (!m_bitmap)
+		return nullptr;
+	m_exactSize = true;
+	const D2D1_SIZE_U allocated = m_bitmap->GetPixelSize();
+	if (allocated.width == m_width && allocated.height == m_height)
+		return m_bitmap.Get();
+
+	// one copy of the viewport into the exact surface, which becomes the target
+	ComPtr<ID2D1Bitmap1> exact;
+	if (!allocateBitmap(exact))
+		return nullptr;
+	const D2D1_RECT_U source = { 0, 0, m_width, m_height };
+	HRESULT hr = exact->CopyFromBitmap(nullptr, m_bitmap.Get(), &source);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not copy viewport: %#lx", __FUNCTION__, hr);
+		return nullptr;
+	}
+	releaseBitmap();
+	m_bitmap = std::move(exact);
+	m_context->SetTarget(m_bitmap.Get());
+	return m_bitmap.Get();
+}
+
+void Direct2DBitmap::releaseBitmap()
+{
+	if (!m_bitmap)
+		return;
+	if (m_context)
+		m_context->SetTarget(nullptr);
+	const D2D1_SIZE_U allocated = m_bitmap->GetPixelSize();
+	// exact sizes off the bucket grid would never be handed out again
+	if (allocated.width != Direct2DBitmapPool::bucket(allocated.width)
+		|| allocated.height != Direct2DBitmapPool::bucket(allocated.height)) {
+		m_bitmap.Reset();
+		return;
+	}
+	// changeDpi has already updated m_dpiX/m_dpiY, the bitmap knows what it was created with
+	Direct2DSurfaceFormat format;
+	m_bitmap->GetDpi(&format.dpiX, &format.dpiY);
+	DirectContext::instance().surfacePool().release(std::move(m_bitmap),
+		format,
+		allocated.width,
+		allocated.height);
+	m_bitmap.Reset();
+}
+
+D2D1_SIZE_U Direct2DBitmap::allocationSize() const
+{
+	if (m_exactSize)
+		return { qMax(m_width, 1u), qMax(m_height, 1u) };
+	return { Direct2DBitmapPool::bucket(m_width), Direct2DBitmapPool::bucket(m_height) };
+}
+
+bool Direct2DBitmap::allocateBitmap(ComPtr<ID2D1Bitmap1>& bitmap)
+{
+	const D2D1_BITMAP_PROPERTIES1 properties = bitmapProperties();
+	Direct2DSurfaceFormat format;
+	format.format = properties.pixelFormat.format;
+	format.options = properties.bitmapOptions;
+	format.dpiX = m_dpiX;
+	format.dpiY = m_dpiY;
+
+	// the pool only holds sizes on the bucket grid, exact sizes may happen to be one
+	const D2D1_SIZE_U size = allocationSize();
+	if (size.width == Direct2DBitmapPool::bucket(size.width)
+		&& size.height == Direct2DBitmapPool::bucket(size.height)) {
+		Direct2DBitmapPool& pool = DirectContext::instance().surfacePool();
+		if (std::optional<ComPtr<ID2D1Bitmap1>> pooled = pool.acquire(format, size.width, size.height)) {
+			bitmap = std::move(*pooled);
+			return true;
 		}
 	}
-	else {
-		qWarning("%s: Could not create device context: %#lx", __FUNCTION__, hr);
+
+	HRESULT hr = m_context->CreateBitmap(size, nullptr, 0, properties, bitmap.ReleaseAndGetAddressOf());
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create bitmap: %#lx", __FUNCTION__, hr);
+		return false;
 	}
-	m_initiated = SUCCEEDED(hr);
-	return m_initiated;
+	return true;
+}
+
+bool Direct2DBitmap::acquireBitmap()
+{
+	releaseBitmap();
+	if (!allocateBitmap(m_bitmap))
+		return false;
+	m_context->SetTarget(m_bitmap.Get());
+	return true;
 }
 
 void Direct2DBitmap::fillRect(const QRect& rect, QColor& color)
@@ -164,6 +236,209 @@ void Direct2DBitmap::flush(QColor color)
 	}
 }
 
+bool Direct2DBitmap::paintTiled(const Direct2DTiledRecorder::PaintFunction& paint)
+{
+	if (!ensureInit())
+		return false;
+
+	m_tiledRecorder.record(QSize(int(m_width), int(m_height)), paint);
+	QPainter painter(this);
+	if (!painter.isActive())
+		return false;
+	m_tiledRecorder.replay(painter);
+	return painter.end();
+}
+
+void Direct2DBitmap::readback(const ReadbackCallback& callback, ReadbackMode mode)
+{
+	if (!ensureInit() || !m_bitmap) {
+		callback(QImage());
+		return;
+	}
+
+	releaseReadbacks();
+	const int index = freeReadbackSlot();
+	if (index < 0) {
+		callback(QImage());
+		return;
+	}
+
+	readbackSlot& slot = m_readbackSlots[size_t(index)];
+	const D2D1_RECT_U source = { 0, 0, m_width, m_height };
+	HRESULT hr = slot.bitmap->CopyFromBitmap(nullptr, m_bitmap.Get(), &source);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not copy bitmap for readback: %#lx", __FUNCTION__, hr);
+		callback(QImage());
+		return;
+	}
+	slot.pending = true;
+	slot.sequence = ++m_readbackSequence;
+	slot.mode = mode;
+	slot.callback = callback;
+
+	// hand out what was queued before this one, its copy had a frame's time to finish
+	std::vector<readbackSlot*> older;
+	for (readbackSlot& other : m_readbackSlots) {
+		if (other.pending && other.sequence < slot.sequence)
+			older.push_back(&other);
+	}
+	std::sort(older.begin(), older.end(), [](const readbackSlot* a, const readbackSlot* b) {
+		return a->sequence < b->sequence;
+	});
+	for (readbackSlot* other : older)
+		deliverReadback(*other);
+}
+
+void Direct2DBitmap::completeReadbacks()
+{
+	std::vector<readbackSlot*> pending;
+	for (readbackSlot& slot : m_readbackSlots) {
+		if (slot.pending)
+			pending.push_back(&slot);
+	}
+	std::sort(pending.begin(), pending.end(), [](const readbackSlot* a, const readbackSlot* b) {
+		return a->sequence < b->sequence;
+	});
+	for (readbackSlot* slot : pending)
+		deliverReadback(*slot);
+}
+
+int Direct2DBitmap::freeReadbackSlot()
+{
+	// only the viewport of the pooled target is read back
+	const D2D1_SIZE_U size = { m_width, m_height };
+	int index = -1;
+	for (size_t i = 0; i < m_readbackSlots.size(); i++) {
+		if (!m_readbackSlots[i].pending && !m_readbackSlots[i].mapped) {
+			index = int(i);
+			break;
+		}
+	}
+	if (index < 0) {
+		// two slots cover steady double buffering, more only while zero copy images are held
+		m_readbackSlots.emplace_back();
+		index = int(m_readbackSlots.size() - 1);
+	}
+
+	readbackSlot& slot = m_readbackSlots[size_t(index)];
+	if (slot.bitmap && slot.size.width == size.width && slot.size.height == size.height)
+		return index;
+
+	slot.bitmap.Reset();
+	HRESULT hr = m_context->CreateBitmap(size,
+		nullptr,
+		0,
+		D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+			D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+			m_dpiX,
+			m_dpiY),
+		slot.bitmap.ReleaseAndGetAddressOf());
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create readback bitmap: %#lx", __FUNCTION__, hr);
+		return -1;
+	}
+	slot.size = size;
+	return index;
+}
+
+void Direct2DBitmap::deliverReadback(readbackSlot& slot)
+{
+	slot.pending = false;
+	ReadbackCallback callback = std::move(slot.callback);
+	slot.callback = nullptr;
+
+	D2D1_MAPPED_RECT mapped;
+	HRESULT hr = slot.bitmap->Map(D2D1_MAP_OPTIONS_READ, &mapped);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not map readback bitmap: %#lx", __FUNCTION__, hr);
+		callback(QImage());
+		return;
+	}
+	slot.mapped = true;
+
+	const int width = int(slot.size.width);
+	const int height = int(slot.size.height);
+	if (slot.mode == ReadbackMode::ZeroCopy) {
+		if (!slot.inUse)
+			slot.inUse = std::make_shared<std::atomic<bool>>(false);
+		slot.inUse->store(true);
+		// the cleanup may run on any thread, it only flags the slot, releaseReadbacks unmaps it
+		auto* flag = new std::shared_ptr<std::atomic<bool>>(slot.inUse);
+		const QImage image(mapped.bits,
+			width,
+			height,
+			qsizetype(mapped.pitch),
+			QImage::Format_ARGB32_Premultiplied,
+			[](void* info) {
+				auto* inUse = static_cast<std::shared_ptr<std::atomic<bool>>*>(info);
+				(*inUse)->store(false);
+				delete inUse;
+			},
+			flag);
+		callback(image);
+		return;
+	}
+
+	// reuse an image the receivers of earlier copies have dropped
+	QImage* target = nullptr;
+	for (QImage& image : m_readbackImages) {
+		if (image.isDetached() && image.width() == width && image.height() == height) {
+			target = &image;
+			break;
+		}
+	}
+	if (!target) {
+		m_readbackImages.emplace_back(width, height, QImage::Format_ARGB32_Premultiplied);
+		target = &m_readbackImages.back();
+	}
+	for (int y = 0; y < height; y++)
+		std::memcpy(target->scanLine(y), mapped.bits + size_t(y) * mapped.pitch, size_t(width) * 4);
+	slot.bitmap->Unmap();
+	slot.mapped = false;
+	const QImage image = *target;
+	callback(image);
+}
+
+void Direct2DBitmap::dropReadbacks()
+{
+	// callbacks run once the slots are gone, they may queue the next readback
+	std::vector<ReadbackCallback> abandoned;
+	for (readbackSlot& slot : m_readbackSlots) {
+		if (slot.pending && slot.callback)
+			abandoned.push_back(std::move(slot.callback));
+		if (!slot.mapped)
+			continue;
+		if (slot.inUse && slot.inUse->load()) {
+			// a zero copy image still points into the mapping, keep it valid rather than crash
+			qWarning("%s: Readback image outlives its slot, leaking the mapping", __FUNCTION__);
+			slot.bitmap.Detach();
+			continue;
+		}
+		slot.bitmap->Unmap();
+	}
+	m_readbackSlots.clear();
+	for (const ReadbackCallback& callback : abandoned)
+		callback(QImage());
+}
+
+void Direct2DBitmap::releaseReadbacks()
+{
+	for (readbackSlot& slot : m_readbackSlots) {
+		if (slot.mapped && !(slot.inUse && slot.inUse->load())) {
+			slot.bitmap->Unmap();
+			slot.mapped = false;
+		}
+	}
+	// images from a different size will not be reused
+	m_readbackImages.erase(std::remove_if(m_readbackImages.begin(),
+							   m_readbackImages.end(),
+							   [this](const QImage& image) {
+								   return image.isDetached()
+									   && image.size() != QSize(int(m_width), int(m_height));
+							   }),
+		m_readbackImages.end());
+}
+
 QPaintEngine* Direct2DBitmap::paintEngine() const
 {
 	return engine.get();
@@ -171,7 +446,15 @@ QPaintEngine* Direct2DBitmap::paintEngine() const
 
 void Direct2DBitmap::recreateTarget()
 {
-	assert(init(width(), height(), physicalDpiX(), physicalDpiY()));
+	// the surface belongs to the lost device, it must not go back to the shared pool
+	m_bitmap.Reset();
+	m_context.Reset();
+	dropReadbacks();
+	// ensureInit() tries again on the next use if the device is not back yet
+	m_initiated = false;
+	const bool ok = init(m_width, m_height, m_dpiX, m_dpiY);
+	Q_ASSERT(ok);
+	Q_UNUSED(ok);
 }
 
 bool Direct2DBitmap::ensureInit()
@@ -1,9 +1,15 @@
 #ifndef DIRECT2DBITMAP_H
 #define DIRECT2DBITMAP_H
 
+#include <QImage>
 #include <QObject>
 #include <QPaintDevice>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
 #include "src/direct2d/direct2dengine.h"
+#include "src/direct2d/direct2dtiledrecorder.h"
 #include <windows.h>
 #include <wrl/client.h>
 #include "direct2ddevicecontext.h"
@@ -14,18 +20,66 @@ class Direct2DBitmap : public QPaintDevice, public IDirect2DDeviceContext
 {
 private:
 	ComPtr<ID2D1Bitmap1> m_bitmap;
+	// set by the first bitmap(), from then on m_bitmap is allocated at exactly m_width x m_height
+	bool m_exactSize;
 	QScopedPointer<Direct2DPaintEngine> engine;
 	FLOAT m_dpiX;
 	FLOAT m_dpiY;
 	UINT32 m_width;
 	UINT32 m_height;
 	bool m_initiated;
+	Direct2DTiledRecorder m_tiledRecorder;
+public:
+	enum class ReadbackMode
+	{
+		// QImage wrapping the mapped bitmap, the slot is unmapped once every copy of it is gone
+		ZeroCopy,
+		// copy into a QImage reused as soon as the receiver drops it, the slot is unmapped at once
+		Copy
+	};
+	using ReadbackCallback = std::function<void(const QImage& image)>;
+private:
+	// CPU readable copy of the target, mapped when the copy is delivered
+	struct readbackSlot
+	{
+		ComPtr<ID2D1Bitmap1> bitmap;
+		D2D1_SIZE_U size = {};
+		bool pending = false;
+		bool mapped = false;
+		quint64 sequence = 0;
+		ReadbackMode mode = ReadbackMode::Copy;
+		ReadbackCallback callback;
+		// cleared by the zero copy QImage cleanup, possibly on another thread
+		std::shared_ptr<std::atomic<bool>> inUse;
+	};
+	std::vector<readbackSlot> m_readbackSlots;
+	std::vector<QImage> m_readbackImages;
+	quint64 m_readbackSequence;
+	int freeReadbackSlot();
+	void deliverReadback(readbackSlot& slot);
+	void releaseReadbacks();
+	// gives up every slot, pending callbacks get a null image
+	void dropReadbacks();
+	// hands m_bitmap back to DirectContext's surface pool
+	void releaseBitmap();
+	// bucketed size of m_width x m_height, or exactly that once bitmap() was used
+	D2D1_SIZE_U allocationSize() const;
+	// a pooled or new bitmap of allocationSize() at the current dpi
+	bool allocateBitmap(ComPtr<ID2D1Bitmap1>& bitmap);
+	// targets a pooled or new bitmap large enough for m_width x m_height at the current dpi
+	bool acquireBitmap();
 protected:
 	int metric(PaintDeviceMetric metric) const override;
 	void recreateTarget() override;
 	bool ensureInit();
 public:
-	inline ID2D1Bitmap1* bitmap() { return m_bitmap.Get(); }
+	// The painted bitmap, exactly the size of the device. The surface behind it comes from a
+	// size bucketed pool and is often larger: the first call moves the content to an exactly
+	// sized surface once and the bitmap keeps allocating exact sizes from then on. Draw
+	// surface() with viewport() as source rect to keep the pooled buckets. Not while painting.
+	ID2D1Bitmap1* bitmap();
+	inline ID2D1Bitmap1* surface() { return m_bitmap.Get(); }
+	inline QRect viewport() const { return QRect(0, 0, int(m_width), int(m_height)); }
 	D2D1_BITMAP_PROPERTIES1 bitmapProperties() const
 	{
 		return D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_TARGET,
@@ -35,7 +89,7 @@ public:
 			m_dpiY);
 	}
 	Direct2DBitmap();
-	~Direct2DBitmap() {};
+	~Direct2DBitmap();
 	bool resize(UINT32 width, UINT32 height);
 	bool changeDpi(FLOAT dpiX, FLOAT dpiY);
 	bool init(UINT32 width, UINT32 height, FLOAT dpiX = 96.0f, FLOAT dpiY = 96.0f);
@@ -43,6 +97,16 @@ public:
 	void fillRect(const QRect& rect, D2D1::ColorF color = D2D1::ColorF::White);
 	void flush(QColor color = Qt::white);
 	QPaintEngine* paintEngine() const override;
+	inline Direct2DTiledRecorder& tiledRecorder() { return m_tiledRecorder; }
+	// Records paint tile by tile on tiledRecorder()'s thread pool, then composites the tiles in order.
+	bool paintTiled(const Direct2DTiledRecorder::PaintFunction& paint);
+	// Queues a GPU copy of the bitmap into a pooled CPU readable bitmap. Nothing is delivered
+	// on its own: the copy is mapped and handed to callback by the next readback() or
+	// completeReadbacks() on this thread, so mapping frame N overlaps rendering frame N+1.
+	// Call completeReadbacks() after the last frame. ZeroCopy images must not outlive this bitmap.
+	void readback(const ReadbackCallback& callback, ReadbackMode mode = ReadbackMode::Copy);
+	// delivers every queued readback, blocking until the GPU finished the copies
+	void completeReadbacks();
 };
 
 #endif // DIRECT2DBITMAP_H
@@ -0,0 +1,366 @@
+#ifndef DIRECT2DCACHEKEYS_H
+#define DIRECT2DCACHEKEYS_H
+
+#include "qbrush.h"
+#include "qfont.h"
+#include "qhashfunctions.h"
+#include "qlist.h"
+#include "qpainterpath.h"
+#include "qpen.h"
+#include "qpoint.h"
+#include "qstring.h"
+#include "qtransform.h"
+#include <type_traits>
+
+// Cache keys for the Direct2D resource caches. They only depend on Qt so hashing and
+// equality can be checked without a Direct2D device.
+
+inline size_t qHashTransform(const QTransform& t, size_t seed = 0)
+{
+	return qHashMulti(seed, t.m11(), t.m12(), t.m21(), t.m22(), t.m31(), t.m32());
+}
+
+inline size_t qHashGradient(const QGradient* gradient, size_t seed = 0)
+{
+	seed = qHashMulti(seed, int(gradient->type()), int(gradient->spread()),
+		int(gradient->coordinateMode()));
+
+	switch (gradient->type()) {
+	case QGradient::LinearGradient: {
+		const auto* linear = static_cast<const QLinearGradient*>(gradient);
+		seed = qHashMulti(seed, linear->start().x(), linear->start().y(),
+			linear->finalStop().x(), linear->finalStop().y());
+	} break;
+	case QGradient::RadialGradient: {
+		const auto* radial = static_cast<const QRadialGradient*>(gradient);
+		seed = qHashMulti(seed, radial->center().x(), radial->center().y(),
+			radial->focalPoint().x(), radial->focalPoint().y(), radial->radius());
+	} break;
+	case QGradient::ConicalGradient: {
+		const auto* conical = static_cast<const QConicalGradient*>(gradient);
+		seed = qHashMulti(seed, conical->center().x(), conical->center().y(), conical->angle());
+	} break;
+	default:
+		break;
+	}
+
+	for (const QGradientStop& stop : gradient->stops())
+		seed = qHashMulti(seed, stop.first, quint64(stop.second.rgba64()));
+	return seed;
+}
+
+// Identifies a device brush built from a QBrush. Everything that gets baked into the
+// ID2D1Brush at creation time is part of the key, so cached brushes are never mutated
+// after creation and can be shared between engines.
+struct Direct2DBrushKey
+{
+	QBrush brush;
+	QPointF origin;
+	qreal opacity = 1.0;
+	bool smooth = false;
+	size_t hash = 0;
+
+	Direct2DBrushKey() = default;
+	Direct2DBrushKey(const QBrush& b, qreal o, const QPointF& brushOrigin, bool smoothPixmapTransform)
+		: brush(b)
+		, opacity(o)
+	{
+		const Qt::BrushStyle style = brush.style();
+		// solid brushes ignore the brush transform, origin and interpolation
+		if (style != Qt::SolidPattern) {
+			origin = brushOrigin;
+			smooth = smoothPixmapTransform;
+		}
+
+		hash = qHashMulti(0, int(style), quint64(brush.color().rgba64()), opacity,
+			origin.x(), origin.y(), smooth);
+		if (style != Qt::SolidPattern)
+			hash = qHashTransform(brush.transform(), hash);
+		if (const QGradient* gradient = brush.gradient())
+			hash = qHashGradient(gradient, hash);
+		else if (style == Qt::TexturePattern)
+			hash = qHashMulti(hash, brush.texture().cacheKey());
+	}
+
+	inline bool operator==(const Direct2DBrushKey& other) const
+	{
+		return hash == other.hash && opacity == other.opacity && smooth == other.smooth
+			&& origin == other.origin && brush == other.brush;
+	}
+};
+
+// Normalized stroke properties of a QPen. Only what ends up in the device independent stroke
+// style is kept: width and brush are passed at draw time, so pens that differ only in those
+// share one stroke style.
+struct Direct2DStrokeKey
+{
+	enum TransformType : quint8
+	{
+		Normal,
+		Fixed,
+		Hairline
+	};
+
+	Qt::PenCapStyle cap = Qt::SquareCap;
+	Qt::PenJoinStyle join = Qt::BevelJoin;
+	Qt::PenStyle style = Qt::SolidLine;
+	TransformType transform = Normal;
+	qreal miterLimit = 2.0;
+	qreal dashOffset = 0.0;
+	QList<qreal> dashes;
+	size_t hash = 0;
+
+	Direct2DStrokeKey() = default;
+	explicit Direct2DStrokeKey(const QPen& pen)
+		: cap(pen.capStyle())
+		, join(pen.joinStyle())
+		, style(pen.style())
+	{
+		if (pen.widthF() == 0)
+			transform = Hairline;
+		else if (pen.isCosmetic())
+			transform = Fixed;
+
+		if (join == Qt::MiterJoin || join == Qt::SvgMiterJoin)
+			miterLimit = pen.miterLimit();
+		if (style != Qt::SolidLine)
+			dashOffset = pen.dashOffset();
+		if (style == Qt::CustomDashLine)
+			dashes = pen.dashPattern();
+		// thin dashed lines are always drawn with flat caps
+		else if (style != Qt::SolidLine && pen.widthF() <= 1.0)
+			cap = Qt::FlatCap;
+
+		hash = qHashMulti(0, int(cap), int(join), int(style), int(transform), miterLimit, dashOffset);
+		for (qreal dash : std::as_const(dashes))
+			hash = qHashMulti(hash, dash);
+	}
+
+	inline bool operator==(const Direct2DStrokeKey& other) const
+	{
+		return hash == other.hash && cap == other.cap && join == other.join && style == other.style
+			&& transform == other.transform && miterLimit == other.miterLimit
+			&& dashOffset == other.dashOffset && dashes == other.dashes;
+	}
+};
+
+// Identifies an uploaded QImage/QPixmap. Both cache keys are (serial << 32) | detach number,
+// so a detached image keeps its serial but gets a new key.
+struct Direct2DBitmapKey
+{
+	qint64 cacheKey = 0;
+	float dpiX = 96.0f;
+	float dpiY = 96.0f;
+	bool pixmap = false;
+
+	inline quint32 serial() const { return quint32(quint64(cacheKey) >> 32); }
+
+	inline bool operator==(const Direct2DBitmapKey& other) const
+	{
+		return cacheKey == other.cacheKey && dpiX == other.dpiX && dpiY == other.dpiY
+			&& pixmap == other.pixmap;
+	}
+};
+
+// Structural hash of a path or polygon. The hash picks the bucket, a hash match compares the
+// elements themselves so a collision never draws another geometry. A lookup key only points at
+// the caller's points, stored() copies them into the key kept by the cache.
+struct Direct2DPathKey
+{
+	enum Kind : quint8
+	{
+		Path,
+		Polyline
+	};
+
+	size_t hash = 0;
+	int count = 0;
+	Kind kind = Path;
+	quint8 fillRule = Qt::OddEvenFill;
+	bool closed = true;
+	QPainterPath path;
+	QList<QPointF> points;
+	const QPointF* pointsF = nullptr;
+	const QPoint* pointsI = nullptr;
+
+	Direct2DPathKey() = default;
+	explicit Direct2DPathKey(const QPainterPath& p)
+		: count(p.elementCount())
+		, fillRule(quint8(p.fillRule()))
+		, path(p)
+	{
+		size_t seed = 0;
+		for (int i = 0; i < count; ++i) {
+			const QPainterPath::Element& e = p.elementAt(i);
+			seed = qHashMulti(seed, e.x, e.y, int(e.type));
+		}
+		hash = seed;
+	}
+
+	template<class Point>
+	Direct2DPathKey(const Point* p, int pointCount, Qt::FillRule rule, bool closedFigure)
+		: count(pointCount)
+		, kind(Polyline)
+		, fillRule(quint8(rule))
+		, closed(closedFigure)
+	{
+		if constexpr (std::is_same_v<Point, QPoint>)
+			pointsI = p;
+		else
+			pointsF = p;
+		size_t seed = 0;
+		for (int i = 0; i < pointCount; ++i)
+			seed = qHashMulti(seed, qreal(p[i].x()), qreal(p[i].y()));
+		hash = seed;
+	}
+
+	inline QPointF pointAt(int i) const
+	{
+		if (pointsF)
+			return pointsF[i];
+		if (pointsI)
+			return QPointF(pointsI[i]);
+		return points.at(i);
+	}
+
+	// copy of the key that owns its points, for inserting into a cache
+	Direct2DPathKey stored() const
+	{
+		Direct2DPathKey key = *this;
+		if (pointsF || pointsI) {
+			key.points.resize(count);
+			for (int i = 0; i < count; ++i)
+				key.points[i] = pointAt(i);
+			key.pointsF = nullptr;
+			key.pointsI = nullptr;
+		}
+		return key;
+	}
+
+	// rough resident size of the device geometry built for this key
+	inline size_t cost() const { return size_t(count) * 32 + 512; }
+
+	inline bool operator==(const Direct2DPathKey& other) const
+	{
+		if (hash != other.hash || count != other.count || kind != other.kind
+			|| fillRule != other.fillRule || closed != other.closed)
+			return false;
+		if (kind == Path) {
+			for (int i = 0; i < count; ++i) {
+				const QPainterPath::Element& a = path.elementAt(i);
+				const QPainterPath::Element& b = other.path.elementAt(i);
+				if (a.x != b.x || a.y != b.y || a.type != b.type)
+					return false;
+			}
+			return true;
+		}
+		// exact, QPointF::operator== is fuzzy
+		for (int i = 0; i < count; ++i) {
+			const QPointF a = pointAt(i);
+			const QPointF b = other.pointAt(i);
+			if (a.x() != b.x() || a.y() != b.y())
+				return false;
+		}
+		return true;
+	}
+};
+
+// Text shaped with a font. The glyph run cache maps it to what QRawFont computed for it,
+// so identical strings (table cells, axis labels) are shaped only once.
+struct Direct2DGlyphRunKey
+{
+	QFont font;
+	QString text;
+	int flags = 0;
+	size_t hash = 0;
+
+	Direct2DGlyphRunKey() = default;
+	Direct2DGlyphRunKey(const QFont& f, const QString& t, int renderFlags)
+		: font(f)
+		, text(t)
+		, flags(renderFlags)
+		, hash(qHashMulti(0, f, t, renderFlags))
+	{}
+
+	inline bool operator==(const Direct2DGlyphRunKey& other) const
+	{
+		return hash == other.hash && flags == other.flags && text == other.text
+			&& font == other.font;
+	}
+};
+
+// Pre-rasterized marker used as sprite source, drawn white so it can be tinted per sprite.
+struct Direct2DMarkerKey
+{
+	enum Shape : quint8
+	{
+		Square,
+		Ellipse,
+		RoundedRect
+	};
+
+	Shape shape = Square;
+	int width = 1; // bitmap size in device pixels
+	int height = 1;
+	float radiusX = 0.0f; // RoundedRect corners
+	float radiusY = 0.0f;
+	float stroke = 0.0f; // outline width, 0 fills the shape
+
+	inline bool operator==(const Direct2DMarkerKey& other) const
+	{
+		return shape == other.shape && width == other.width && height == other.height
+			&& radiusX == other.radiusX && radiusY == other.radiusY && stroke == other.stroke;
+	}
+};
+
+namespace std {
+	template<>
+	struct hash<QFont>
+	{
+		inline size_t operator()(const QFont& f) const { return qHash(f); }
+	};
+
+	template<>
+	struct hash<Direct2DMarkerKey>
+	{
+		inline size_t operator()(const Direct2DMarkerKey& k) const
+		{
+			return qHashMulti(0, int(k.shape), k.width, k.height, k.radiusX, k.radiusY, k.stroke);
+		}
+	};
+
+	template<>
+	struct hash<Direct2DGlyphRunKey>
+	{
+		inline size_t operator()(const Direct2DGlyphRunKey& k) const { return k.hash; }
+	};
+
+	template<>
+	struct hash<Direct2DPathKey>
+	{
+		inline size_t operator()(const Direct2DPathKey& k) const { return k.hash; }
+	};
+
+	template<>
+	struct hash<Direct2DBitmapKey>
+	{
+		inline size_t operator()(const Direct2DBitmapKey& k) const
+		{
+			return qHashMulti(0, k.cacheKey, k.dpiX, k.dpiY, k.pixmap);
+		}
+	};
+
+	template<>
+	struct hash<Direct2DBrushKey>
+	{
+		inline size_t operator()(const Direct2DBrushKey& k) const { return k.hash; }
+	};
+
+	template<>
+	struct hash<Direct2DStrokeKey>
+	{
+		inline size_t operator()(const Direct2DStrokeKey& k) const { return k.hash; }
+	};
+}
+
+#endif // DIRECT2DCACHEKEYS_H
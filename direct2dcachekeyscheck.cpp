@@ -0,0 +1,115 @@
+// Checks that path keys whose hashes collide still compare by their elements, in and out of a
+// Direct2DLruCache, so a collision never hands out the geometry of another shape. Only depends
+// on QtGui, build it with direct2dcachekeys.h and direct2dlrucache.h on the include path and
+// run it anywhere. Exits with 0 when every check passes.
+#include <QPainterPath>
+#include <QPoint>
+#include <QPointF>
+#include <cstdio>
+#include <vector>
+#include "src/direct2d/direct2dcachekeys.h"
+#include "src/direct2d/direct2dlrucache.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+	if (!ok) {
+		std::printf("%s\n", what);
+		failures++;
+	}
+}
+
+// every key in one bucket, lookups can only tell keys apart by operator==
+struct CollidingHash
+{
+	inline size_t operator()(const Direct2DPathKey&) const { return 0; }
+};
+
+template<class Point>
+static Direct2DPathKey collidingKey(const Point* points, int count, bool closed = true)
+{
+	Direct2DPathKey key(points, count, Qt::OddEvenFill, closed);
+	key.hash = 0;
+	return key;
+}
+
+static Direct2DPathKey collidingKey(const QPainterPath& path)
+{
+	Direct2DPathKey key(path);
+	key.hash = 0;
+	return key;
+}
+
+static void checkEquality()
+{
+	const QPointF a[] = { QPointF(0, 0), QPointF(10, 0), QPointF(10, 10) };
+	const QPointF b[] = { QPointF(0, 0), QPointF(10, 0), QPointF(10, 10.5) };
+	// closer than QPointF::operator== can tell apart
+	const QPointF c[] = { QPointF(0, 0), QPointF(10, 0), QPointF(10, 10 + 1e-13) };
+	const QPoint ai[] = { QPoint(0, 0), QPoint(10, 0), QPoint(10, 10) };
+
+	check(collidingKey(a, 3) == collidingKey(a, 3), "path key: equal points differ");
+	check(!(collidingKey(a, 3) == collidingKey(b, 3)), "path key: colliding polygons compare equal");
+	check(!(collidingKey(a, 3) == collidingKey(c, 3)), "path key: fuzzy point compare");
+	check(!(collidingKey(a, 3) == collidingKey(a, 2)), "path key: prefix compares equal");
+	check(!(collidingKey(a, 3) == collidingKey(a, 3, false)), "path key: open and closed compare equal");
+	check(collidingKey(a, 3) == collidingKey(ai, 3), "path key: integer points differ from the same floats");
+
+	QPainterPath square;
+	square.addRect(0, 0, 10, 10);
+	QPainterPath ellipse;
+	ellipse.addEllipse(0, 0, 10, 10);
+	QPainterPath moved = square.translated(0, 1e-13);
+	QPainterPath winding = square;
+	winding.setFillRule(Qt::WindingFill);
+	check(collidingKey(square) == collidingKey(QPainterPath(square)), "path key: equal paths differ");
+	check(!(collidingKey(square) == collidingKey(ellipse)), "path key: colliding paths compare equal");
+	check(!(collidingKey(square) == collidingKey(moved)), "path key: fuzzy path compare");
+	check(!(collidingKey(square) == collidingKey(winding)), "path key: fill rules compare equal");
+
+	// polygons and paths never match, whatever their elements
+	const QPointF squarePoints[] = { QPointF(0, 0), QPointF(10, 0), QPointF(10, 10), QPointF(0, 10),
+		QPointF(0, 0) };
+	check(!(collidingKey(squarePoints, 5) == collidingKey(square)), "path key: polygon equals a path");
+
+	// the stored key owns its points, the caller's buffer is free to change afterwards
+	std::vector<QPointF> buffer(a, a + 3);
+	const Direct2DPathKey stored = collidingKey(buffer.data(), 3).stored();
+	buffer[2] = QPointF(99, 99);
+	check(stored == collidingKey(a, 3), "path key: stored key follows the caller's points");
+	check(!(stored == collidingKey(buffer.data(), 3)), "path key: stored key matches changed points");
+}
+
+static void checkCache()
+{
+	Direct2DLruCache<Direct2DPathKey, int, CollidingHash> cache(1024 * 1024);
+	std::vector<std::vector<QPointF>> polygons;
+	for (int i = 0; i < 64; ++i) {
+		// shapes only a few ulps apart, all in the same bucket
+		std::vector<QPointF> points = { QPointF(0, 0), QPointF(10, 0), QPointF(10, 10 + i * 1e-12) };
+		polygons.push_back(points);
+	}
+	for (int i = 0; i < int(polygons.size()); ++i) {
+		const Direct2DPathKey key = collidingKey(polygons[size_t(i)].data(), 3);
+		cache.insert(key.stored(), i, key.cost());
+	}
+	check(cache.count() == polygons.size(), "path cache: colliding keys replaced each other");
+	for (int i = 0; i < int(polygons.size()); ++i) {
+		const int* value = cache.find(collidingKey(polygons[size_t(i)].data(), 3));
+		if (!value || *value != i) {
+			std::printf("path cache: polygon %d found %s\n", i, value ? "another polygon" : "nothing");
+			failures++;
+		}
+	}
+	const QPointF other[] = { QPointF(0, 0), QPointF(10, 0), QPointF(10, 11) };
+	check(cache.find(collidingKey(other, 3)) == nullptr, "path cache: found a polygon never inserted");
+}
+
+int main()
+{
+	checkEquality();
+	checkCache();
+	std::printf("cache keys: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
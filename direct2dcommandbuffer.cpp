@@ -0,0 +1,667 @@
+#include "direct2dcommandbuffer.h"
+#include <climits>
+#include <cstring>
+#include <new>
+
+#define UNUSED(A) void(A)
+
+namespace {
+	struct transformPayload
+	{
+		qreal m[9];
+	};
+
+	struct indexPayload
+	{
+		quint32 index;
+		qint32 value;
+	};
+
+	struct imagePayload
+	{
+		QRectF rect;
+		QRectF source;
+		quint32 index;
+	};
+
+	struct tiledPayload
+	{
+		QRectF rect;
+		QPointF offset;
+		quint32 index;
+	};
+
+	struct textPayload
+	{
+		QPointF position;
+		quint32 text;
+		quint32 font;
+	};
+
+	inline size_t alignedSize(size_t size)
+	{
+		return (size + 7) & ~size_t(7);
+	}
+}
+
+Direct2DCommandBuffer::Direct2DCommandBuffer()
+	: m_commandCount(0)
+{}
+
+void Direct2DCommandBuffer::clear()
+{
+	m_data.clear();
+	m_pens.clear();
+	m_brushes.clear();
+	m_paths.clear();
+	m_regions.clear();
+	m_images.clear();
+	m_pixmaps.clear();
+	m_texts.clear();
+	m_fonts.clear();
+	m_commandCount = 0;
+}
+
+quint8* Direct2DCommandBuffer::allocate(Command command, size_t payloadSize, quint16 flags)
+{
+	const size_t size = alignedSize(sizeof(header) + payloadSize);
+	const size_t offset = m_data.size();
+	m_data.resize(offset + size);
+
+	quint8* at = m_data.data() + offset;
+	new (at) header{ quint16(command), flags, quint32(size) };
+	++m_commandCount;
+	return at + sizeof(header);
+}
+
+template<class T>
+T* Direct2DCommandBuffer::allocateArray(Command command, int count, quint16 flags)
+{
+	quint8* payload = allocate(command, sizeof(qint32) * 2 + sizeof(T) * size_t(count), flags);
+	const qint32 n = count;
+	std::memcpy(payload, &n, sizeof(n));
+	return reinterpret_cast<T*>(payload + sizeof(qint32) * 2);
+}
+
+template<class T>
+quint32 Direct2DCommandBuffer::pushIndex(std::vector<T>& table, const T& value)
+{
+	// consecutive uses of the same state value share one slot
+	if (table.empty() || !(table.back() == value))
+		table.push_back(value);
+	return quint32(table.size() - 1);
+}
+
+template<class T>
+quint32 Direct2DCommandBuffer::pushValue(std::vector<T>& table, const T& value)
+{
+	table.push_back(value);
+	return quint32(table.size() - 1);
+}
+
+void Direct2DCommandBuffer::setPen(const QPen& pen)
+{
+	auto* payload = reinterpret_cast<indexPayload*>(allocate(Command::SetPen, sizeof(indexPayload)));
+	payload->index = pushIndex(m_pens, pen);
+}
+
+void Direct2DCommandBuffer::setBrush(const QBrush& brush)
+{
+	auto* payload = reinterpret_cast<indexPayload*>(allocate(Command::SetBrush, sizeof(indexPayload)));
+	payload->index = pushIndex(m_brushes, brush);
+}
+
+void Direct2DCommandBuffer::setBrushOrigin(const QPointF& origin)
+{
+	new (allocate(Command::SetBrushOrigin, sizeof(QPointF))) QPointF(origin);
+}
+
+void Direct2DCommandBuffer::setTransform(const QTransform& transform)
+{
+	new (allocate(Command::SetTransform, sizeof(transformPayload))) transformPayload{
+		{ transform.m11(), transform.m12(), transform.m13(),
+		 transform.m21(), transform.m22(), transform.m23(),
+		 transform.m31(), transform.m32(), transform.m33() }
+	};
+}
+
+void Direct2DCommandBuffer::setRenderHints(QPainter::RenderHints hints)
+{
+	new (allocate(Command::SetRenderHints, sizeof(indexPayload))) indexPayload{ 0, qint32(hints.toInt()) };
+}
+
+void Direct2DCommandBuffer::setCompositionMode(QPainter::CompositionMode mode)
+{
+	new (allocate(Command::SetCompositionMode, sizeof(indexPayload))) indexPayload{ 0, qint32(mode) };
+}
+
+void Direct2DCommandBuffer::setOpacity(qreal opacity)
+{
+	new (allocate(Command::SetOpacity, sizeof(qreal))) qreal(opacity);
+}
+
+void Direct2DCommandBuffer::setClipRegion(const QRegion& region, Qt::ClipOperation op)
+{
+	auto* payload = reinterpret_cast<indexPayload*>(allocate(Command::SetClipRegion, sizeof(indexPayload)));
+	payload->index = pushValue(m_regions, region);
+	payload->value = qint32(op);
+}
+
+void Direct2DCommandBuffer::setClipPath(const QPainterPath& path, Qt::ClipOperation op)
+{
+	auto* payload = reinterpret_cast<indexPayload*>(allocate(Command::SetClipPath, sizeof(indexPayload)));
+	payload->index = pushValue(m_paths, path);
+	payload->value = qint32(op);
+}
+
+void Direct2DCommandBuffer::setClipEnabled(bool enabled)
+{
+	new (allocate(Command::SetClipEnabled, sizeof(indexPayload))) indexPayload{ 0, qint32(enabled) };
+}
+
+void Direct2DCommandBuffer::drawLines(const QLineF* lines, int lineCount)
+{
+	std::memcpy(allocateArray<QLineF>(Command::DrawLines, lineCount), lines, sizeof(QLineF) * size_t(lineCount));
+}
+
+void Direct2DCommandBuffer::drawLines(const QLine* lines, int lineCount)
+{
+	QLineF* out = allocateArray<QLineF>(Command::DrawLines, lineCount);
+	for (int i = 0; i < lineCount; ++i)
+		new (out + i) QLineF(lines[i]);
+}
+
+void Direct2DCommandBuffer::drawRects(const QRectF* rects, int rectCount)
+{
+	std::memcpy(allocateArray<QRectF>(Command::DrawRects, rectCount), rects, sizeof(QRectF) * size_t(rectCount));
+}
+
+void Direct2DCommandBuffer::drawRects(const QRect* rects, int rectCount)
+{
+	QRectF* out = allocateArray<QRectF>(Command::DrawRects, rectCount);
+	for (int i = 0; i < rectCount; ++i)
+		new (out + i) QRectF(rects[i]);
+}
+
+void Direct2DCommandBuffer::drawPoints(const QPointF* points, int pointCount)
+{
+	std::memcpy(allocateArray<QPointF>(Command::DrawPoints, pointCount), points, sizeof(QPointF) * size_t(pointCount));
+}
+
+void Direct2DCommandBuffer::drawPoints(const QPoint* points, int pointCount)
+{
+	QPointF* out = allocateArray<QPointF>(Command::DrawPoints, pointCount);
+	for (int i = 0; i < pointCount; ++i)
+		new (out + i) QPointF(points[i]);
+}
+
+void Direct2DCommandBuffer::drawPolygon(const QPointF* points,
+	int pointCount,
+	QPaintEngine::PolygonDrawMode mode)
+{
+	std::memcpy(allocateArray<QPointF>(Command::DrawPolygon, pointCount, quint16(mode)),
+		points,
+		sizeof(QPointF) * size_t(pointCount));
+}
+
+void Direct2DCommandBuffer::drawPolygon(const QPoint* points,
+	int pointCount,
+	QPaintEngine::PolygonDrawMode mode)
+{
+	QPointF* out = allocateArray<QPointF>(Command::DrawPolygon, pointCount, quint16(mode));
+	for (int i = 0; i < pointCount; ++i)
+		new (out + i) QPointF(points[i]);
+}
+
+void Direct2DCommandBuffer::drawEllipse(const QRectF& rect)
+{
+	new (allocate(Command::DrawEllipse, sizeof(QRectF))) QRectF(rect);
+}
+
+void Direct2DCommandBuffer::drawPath(const QPainterPath& path)
+{
+	auto* payload = reinterpret_cast<indexPayload*>(allocate(Command::DrawPath, sizeof(indexPayload)));
+	payload->index = pushValue(m_paths, path);
+}
+
+void Direct2DCommandBuffer::drawImage(const QRectF& rect, const QImage& image, const QRectF& sr)
+{
+	new (allocate(Command::DrawImage, sizeof(imagePayload))) imagePayload{ rect, sr, pushValue(m_images, image) };
+}
+
+void Direct2DCommandBuffer::drawPixmap(const QRectF& rect, const QPixmap& pixmap, const QRectF& sr)
+{
+	new (allocate(Command::DrawPixmap, sizeof(imagePayload))) imagePayload{ rect, sr, pushValue(m_pixmaps, pixmap) };
+}
+
+void Direct2DCommandBuffer::drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p)
+{
+	new (allocate(Command::DrawTiledPixmap, sizeof(tiledPayload))) tiledPayload{ rect, p, pushValue(m_pixmaps, pixmap) };
+}
+
+void Direct2DCommandBuffer::drawText(const QPointF& p, const QString& text, const QFont& font)
+{
+	new (allocate(Command::DrawText, sizeof(textPayload)))
+		textPayload{ p, pushValue(m_texts, text), pushIndex(m_fonts, font) };
+}
+
+void Direct2DCommandBuffer::replay(Direct2DCommandSink& sink) const
+{
+	const quint8* at = m_data.data();
+	const quint8* const end = at + m_data.size();
+
+	while (at < end) {
+		const header* h = reinterpret_cast<const header*>(at);
+		const quint8* payload = at + sizeof(header);
+		const auto* index = reinterpret_cast<const indexPayload*>(payload);
+		const qint32 count = *reinterpret_cast<const qint32*>(payload);
+		const quint8* array = payload + sizeof(qint32) * 2;
+
+		switch (Command(h->command)) {
+		case Command::SetPen:
+			sink.setPen(m_pens[index->index]);
+			break;
+		case Command::SetBrush:
+			sink.setBrush(m_brushes[index->index]);
+			break;
+		case Command::SetBrushOrigin:
+			sink.setBrushOrigin(*reinterpret_cast<const QPointF*>(payload));
+			break;
+		case Command::SetTransform: {
+			const qreal* m = reinterpret_cast<const transformPayload*>(payload)->m;
+			sink.setTransform(QTransform(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8]));
+		} break;
+		case Command::SetRenderHints:
+			sink.setRenderHints(QPainter::RenderHints::fromInt(index->value));
+			break;
+		case Command::SetCompositionMode:
+			sink.setCompositionMode(QPainter::CompositionMode(index->value));
+			break;
+		case Command::SetOpacity:
+			sink.setOpacity(*reinterpret_cast<const qreal*>(payload));
+			break;
+		case Command::SetClipRegion:
+			sink.setClipRegion(m_regions[index->index], Qt::ClipOperation(index->value));
+			break;
+		case Command::SetClipPath:
+			sink.setClipPath(m_paths[index->index], Qt::ClipOperation(index->value));
+			break;
+		case Command::SetClipEnabled:
+			sink.setClipEnabled(index->value != 0);
+			break;
+		case Command::DrawLines:
+			sink.drawLines(reinterpret_cast<const QLineF*>(array), count);
+			break;
+		case Command::DrawRects:
+			sink.drawRects(reinterpret_cast<const QRectF*>(array), count);
+			break;
+		case Command::DrawPoints:
+			sink.drawPoints(reinterpret_cast<const QPointF*>(array), count);
+			break;
+		case Command::DrawPolygon:
+			sink.drawPolygon(reinterpret_cast<const QPointF*>(array),
+				count,
+				QPaintEngine::PolygonDrawMode(h->flags));
+			break;
+		case Command::DrawEllipse:
+			sink.drawEllipse(*reinterpret_cast<const QRectF*>(payload));
+			break;
+		case Command::DrawPath:
+			sink.drawPath(m_paths[index->index]);
+			break;
+		case Command::DrawImage: {
+			const auto* image = reinterpret_cast<const imagePayload*>(payload);
+			sink.drawImage(image->rect, m_images[image->index], image->source);
+		} break;
+		case Command::DrawPixmap: {
+			const auto* pixmap = reinterpret_cast<const imagePayload*>(payload);
+			sink.drawPixmap(pixmap->rect, m_pixmaps[pixmap->index], pixmap->source);
+		} break;
+		case Command::DrawTiledPixmap: {
+			const auto* tiled = reinterpret_cast<const tiledPayload*>(payload);
+			sink.drawTiledPixmap(tiled->rect, m_pixmaps[tiled->index], tiled->offset);
+		} break;
+		case Command::DrawText: {
+			const auto* text = reinterpret_cast<const textPayload*>(payload);
+			sink.drawText(text->position, m_texts[text->text], m_fonts[text->font]);
+		} break;
+		}
+
+		at += h->size;
+	}
+}
+
+void Direct2DCommandBuffer::replay(QPainter& painter) const
+{
+	Direct2DPainterSink sink(painter);
+	painter.save();
+	replay(sink);
+	painter.restore();
+}
+
+Direct2DPainterSink::Direct2DPainterSink(QPainter& painter)
+	: m_painter(painter)
+	, m_baseTransform(painter.worldTransform())
+	, m_hasBaseClip(painter.hasClipping())
+{
+	if (m_hasBaseClip)
+		m_baseClip = m_baseTransform.map(painter.clipPath());
+}
+
+void Direct2DPainterSink::restoreBaseClip()
+{
+	const QTransform transform = m_painter.worldTransform();
+	m_painter.setWorldTransform(QTransform());
+	m_painter.setClipPath(m_baseClip, Qt::ReplaceClip);
+	m_painter.setWorldTransform(transform);
+}
+
+void Direct2DPainterSink::setPen(const QPen& pen)
+{
+	m_painter.setPen(pen);
+}
+
+void Direct2DPainterSink::setBrush(const QBrush& brush)
+{
+	m_painter.setBrush(brush);
+}
+
+void Direct2DPainterSink::setBrushOrigin(const QPointF& origin)
+{
+	m_painter.setBrushOrigin(origin);
+}
+
+void Direct2DPainterSink::setTransform(const QTransform& transform)
+{
+	m_painter.setWorldTransform(transform * m_baseTransform);
+}
+
+void Direct2DPainterSink::setRenderHints(QPainter::RenderHints hints)
+{
+	m_painter.setRenderHints(~hints, false);
+	m_painter.setRenderHints(hints, true);
+}
+
+void Direct2DPainterSink::setCompositionMode(QPainter::CompositionMode mode)
+{
+	m_painter.setCompositionMode(mode);
+}
+
+void Direct2DPainterSink::setOpacity(qreal opacity)
+{
+	m_painter.setOpacity(opacity);
+}
+
+void Direct2DPainterSink::setClipRegion(const QRegion& region, Qt::ClipOperation op)
+{
+	if (m_hasBaseClip && op != Qt::IntersectClip) {
+		restoreBaseClip();
+		if (op == Qt::NoClip)
+			return;
+		op = Qt::IntersectClip;
+	}
+	m_painter.setClipRegion(region, op);
+}
+
+void Direct2DPainterSink::setClipPath(const QPainterPath& path, Qt::ClipOperation op)
+{
+	if (m_hasBaseClip && op != Qt::IntersectClip) {
+		restoreBaseClip();
+		if (op == Qt::NoClip)
+			return;
+		op = Qt::IntersectClip;
+	}
+	m_painter.setClipPath(path, op);
+}
+
+void Direct2DPainterSink::setClipEnabled(bool enabled)
+{
+	// disabling the recorded clip falls back to the clip of the replaying painter
+	if (m_hasBaseClip && !enabled) {
+		restoreBaseClip();
+		return;
+	}
+	m_painter.setClipping(enabled);
+}
+
+void Direct2DPainterSink::drawLines(const QLineF* lines, int lineCount)
+{
+	m_painter.drawLines(lines, lineCount);
+}
+
+void Direct2DPainterSink::drawRects(const QRectF* rects, int rectCount)
+{
+	m_painter.drawRects(rects, rectCount);
+}
+
+void Direct2DPainterSink::drawPoints(const QPointF* points, int pointCount)
+{
+	m_painter.drawPoints(points, pointCount);
+}
+
+void Direct2DPainterSink::drawPolygon(const QPointF* points,
+	int pointCount,
+	QPaintEngine::PolygonDrawMode mode)
+{
+	switch (mode) {
+	case QPaintEngine::OddEvenMode:
+		m_painter.drawPolygon(points, pointCount, Qt::OddEvenFill);
+		break;
+	case QPaintEngine::WindingMode:
+		m_painter.drawPolygon(points, pointCount, Qt::WindingFill);
+		break;
+	case QPaintEngine::ConvexMode:
+		m_painter.drawConvexPolygon(points, pointCount);
+		break;
+	case QPaintEngine::PolylineMode:
+		m_painter.drawPolyline(points, pointCount);
+		break;
+	}
+}
+
+void Direct2DPainterSink::drawEllipse(const QRectF& rect)
+{
+	m_painter.drawEllipse(rect);
+}
+
+void Direct2DPainterSink::drawPath(const QPainterPath& path)
+{
+	m_painter.drawPath(path);
+}
+
+void Direct2DPainterSink::drawImage(const QRectF& rect, const QImage& image, const QRectF& sr)
+{
+	m_painter.drawImage(rect, image, sr);
+}
+
+void Direct2DPainterSink::drawPixmap(const QRectF& rect, const QPixmap& pixmap, const QRectF& sr)
+{
+	m_painter.drawPixmap(rect, pixmap, sr);
+}
+
+void Direct2DPainterSink::drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p)
+{
+	m_painter.drawTiledPixmap(rect, pixmap, p);
+}
+
+void Direct2DPainterSink::drawText(const QPointF& p, const QString& text, const QFont& font)
+{
+	m_painter.setFont(font);
+	m_painter.drawText(p, text);
+}
+
+Direct2DRecordingEngine::Direct2DRecordingEngine(Direct2DCommandBuffer* buffer)
+	: QPaintEngine(QPaintEngine::AllFeatures)
+	, m_buffer(buffer)
+{}
+
+bool Direct2DRecordingEngine::begin(QPaintDevice* pdev)
+{
+	UNUSED(pdev);
+	setActive(true);
+	return true;
+}
+
+bool Direct2DRecordingEngine::end()
+{
+	setActive(false);
+	return true;
+}
+
+void Direct2DRecordingEngine::updateState(const QPaintEngineState& sstate)
+{
+	const QPaintEngine::DirtyFlags flags = sstate.state();
+
+	if (flags.testFlag(QPaintEngine::DirtyPen))
+		m_buffer->setPen(sstate.pen());
+	if (flags.testFlag(QPaintEngine::DirtyBrush))
+		m_buffer->setBrush(sstate.brush());
+	if (flags.testFlag(QPaintEngine::DirtyBrushOrigin))
+		m_buffer->setBrushOrigin(sstate.brushOrigin());
+	if (flags.testFlag(QPaintEngine::DirtyOpacity))
+		m_buffer->setOpacity(sstate.opacity());
+	if (flags.testFlag(QPaintEngine::DirtyCompositionMode))
+		m_buffer->setCompositionMode(sstate.compositionMode());
+	if (flags.testFlag(QPaintEngine::DirtyHints))
+		m_buffer->setRenderHints(sstate.renderHints());
+	// clips are expressed in the transform that comes with them, record it first
+	if (flags.testFlag(QPaintEngine::DirtyTransform))
+		m_buffer->setTransform(sstate.transform());
+	if (flags.testFlag(QPaintEngine::DirtyClipRegion))
+		m_buffer->setClipRegion(sstate.clipRegion(), sstate.clipOperation());
+	if (flags.testFlag(QPaintEngine::DirtyClipPath))
+		m_buffer->setClipPath(sstate.clipPath(), sstate.clipOperation());
+	if (flags.testFlag(QPaintEngine::DirtyClipEnabled))
+		m_buffer->setClipEnabled(sstate.isClipEnabled());
+}
+
+QPaintEngine::Type Direct2DRecordingEngine::type() const
+{
+	return User;
+}
+
+void Direct2DRecordingEngine::drawPixmap(const QRectF& r, const QPixmap& pm, const QRectF& sr)
+{
+	m_buffer->drawPixmap(r, pm, sr);
+}
+
+void Direct2DRecordingEngine::drawEllipse(const QRectF& rect)
+{
+	m_buffer->drawEllipse(rect);
+}
+
+void Direct2DRecordingEngine::drawEllipse(const QRect& rect)
+{
+	m_buffer->drawEllipse(QRectF(rect));
+}
+
+void Direct2DRecordingEngine::drawImage(const QRectF& rectangle,
+	const QImage& image,
+	const QRectF& sr,
+	Qt::ImageConversionFlags flags)
+{
+	UNUSED(flags);
+	m_buffer->drawImage(rectangle, image, sr);
+}
+
+void Direct2DRecordingEngine::drawLines(const QLineF* lines, int lineCount)
+{
+	m_buffer->drawLines(lines, lineCount);
+}
+
+void Direct2DRecordingEngine::drawLines(const QLine* lines, int lineCount)
+{
+	m_buffer->drawLines(lines, lineCount);
+}
+
+void Direct2DRecordingEngine::drawPath(const QPainterPath& path)
+{
+	m_buffer->drawPath(path);
+}
+
+void Direct2DRecordingEngine::drawPoints(const QPointF* points, int pointCount)
+{
+	m_buffer->drawPoints(points, pointCount);
+}
+
+void Direct2DRecordingEngine::drawPoints(const QPoint* points, int pointCount)
+{
+	m_buffer->drawPoints(points, pointCount);
+}
+
+void Direct2DRecordingEngine::drawPolygon(const QPointF* points,
+	int pointCount,
+	QPaintEngine::PolygonDrawMode mode)
+{
+	m_buffer->drawPolygon(points, pointCount, mode);
+}
+
+void Direct2DRecordingEngine::drawPolygon(const QPoint* points,
+	int pointCount,
+	QPaintEngine::PolygonDrawMode mode)
+{
+	m_buffer->drawPolygon(points, pointCount, mode);
+}
+
+void Direct2DRecordingEngine::drawRects(const QRectF* rects, int rectCount)
+{
+	m_buffer->drawRects(rects, rectCount);
+}
+
+void Direct2DRecordingEngine::drawRects(const QRect* rects, int rectCount)
+{
+	m_buffer->drawRects(rects, rectCount);
+}
+
+void Direct2DRecordingEngine::drawTextItem(const QPointF& p, const QTextItem& textItem)
+{
+	m_buffer->drawText(p, textItem.text(), textItem.font());
+}
+
+void Direct2DRecordingEngine::drawTiledPixmap(const QRectF& rect,
+	const QPixmap& pixmap,
+	const QPointF& p)
+{
+	m_buffer->drawTiledPixmap(rect, pixmap, p);
+}
+
+Direct2DRecordingDevice::Direct2DRecordingDevice(const QSize& size, int dpi)
+	: m_size(size)
+	, m_dpi(dpi)
+	, engine(new Direct2DRecordingEngine(&m_commands))
+{}
+
+Direct2DRecordingDevice::~Direct2DRecordingDevice() {}
+
+QPaintEngine* Direct2DRecordingDevice::paintEngine() const
+{
+	return engine.get();
+}
+
+int Direct2DRecordingDevice::metric(PaintDeviceMetric metric) const
+{
+	switch (metric) {
+	case QPaintDevice::PdmWidth:
+		return m_size.width();
+	case QPaintDevice::PdmHeight:
+		return m_size.height();
+	case QPaintDevice::PdmWidthMM:
+		return qRound(m_size.width() * 25.4 / m_dpi);
+	case QPaintDevice::PdmHeightMM:
+		return qRound(m_size.height() * 25.4 / m_dpi);
+	case QPaintDevice::PdmNumColors:
+		return INT_MAX;
+	case QPaintDevice::PdmDepth:
+		return 32;
+	case QPaintDevice::PdmPhysicalDpiX:
+	case QPaintDevice::PdmDpiX:
+	case QPaintDevice::PdmPhysicalDpiY:
+	case QPaintDevice::PdmDpiY:
+		return m_dpi;
+	case QPaintDevice::PdmDevicePixelRatio:
+		return 1;
+	case QPaintDevice::PdmDevicePixelRatioScaled:
+		return int(QPaintDevice::devicePixelRatioFScale());
+	}
+	return -1;
+}
@@ -0,0 +1,244 @@
+#ifndef DIRECT2DCOMMANDBUFFER_H
+#define DIRECT2DCOMMANDBUFFER_H
+
+#include <QFont>
+#include <QImage>
+#include <QPainterPath>
+#include <QPixmap>
+#include <QRegion>
+#include <QScopedPointer>
+#include <vector>
+#include "qpaintengine.h"
+#include "qpainter.h"
+
+// Receives the commands of a Direct2DCommandBuffer during replay.
+class Direct2DCommandSink
+{
+public:
+	virtual ~Direct2DCommandSink() = default;
+
+	virtual void setPen(const QPen& pen) = 0;
+	virtual void setBrush(const QBrush& brush) = 0;
+	virtual void setBrushOrigin(const QPointF& origin) = 0;
+	virtual void setTransform(const QTransform& transform) = 0;
+	virtual void setRenderHints(QPainter::RenderHints hints) = 0;
+	virtual void setCompositionMode(QPainter::CompositionMode mode) = 0;
+	virtual void setOpacity(qreal opacity) = 0;
+	virtual void setClipRegion(const QRegion& region, Qt::ClipOperation op) = 0;
+	virtual void setClipPath(const QPainterPath& path, Qt::ClipOperation op) = 0;
+	virtual void setClipEnabled(bool enabled) = 0;
+
+	virtual void drawLines(const QLineF* lines, int lineCount) = 0;
+	virtual void drawRects(const QRectF* rects, int rectCount) = 0;
+	virtual void drawPoints(const QPointF* points, int pointCount) = 0;
+	virtual void drawPolygon(const QPointF* points,
+		int pointCount,
+		QPaintEngine::PolygonDrawMode mode) = 0;
+	virtual void drawEllipse(const QRectF& rect) = 0;
+	virtual void drawPath(const QPainterPath& path) = 0;
+	virtual void drawImage(const QRectF& rect, const QImage& image, const QRectF& sr) = 0;
+	virtual void drawPixmap(const QRectF& rect, const QPixmap& pixmap, const QRectF& sr) = 0;
+	virtual void drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p) = 0;
+	virtual void drawText(const QPointF& p, const QString& text, const QFont& font) = 0;
+};
+
+// Forwards replayed commands to a QPainter. Painting on a Direct2DWidget or Direct2DBitmap
+// replays onto its device context, painting on a QImage gives the raster reference.
+// Recorded transforms and clips are relative to the painter state the sink was created with:
+// transforms are applied on top of its world transform and no recorded clip reaches outside
+// of its clip.
+class Direct2DPainterSink final : public Direct2DCommandSink
+{
+private:
+	QPainter& m_painter;
+	QTransform m_baseTransform;
+	// the clip of the painter at creation, in untransformed coordinates
+	QPainterPath m_baseClip;
+	bool m_hasBaseClip;
+
+	void restoreBaseClip();
+
+public:
+	explicit Direct2DPainterSink(QPainter& painter);
+
+	void setPen(const QPen& pen) override;
+	void setBrush(const QBrush& brush) override;
+	void setBrushOrigin(const QPointF& origin) override;
+	void setTransform(const QTransform& transform) override;
+	void setRenderHints(QPainter::RenderHints hints) override;
+	void setCompositionMode(QPainter::CompositionMode mode) override;
+	void setOpacity(qreal opacity) override;
+	void setClipRegion(const QRegion& region, Qt::ClipOperation op) override;
+	void setClipPath(const QPainterPath& path, Qt::ClipOperation op) override;
+	void setClipEnabled(bool enabled) override;
+	void drawLines(const QLineF* lines, int lineCount) override;
+	void drawRects(const QRectF* rects, int rectCount) override;
+	void drawPoints(const QPointF* points, int pointCount) override;
+	void drawPolygon(const QPointF* points,
+		int pointCount,
+		QPaintEngine::PolygonDrawMode mode) override;
+	void drawEllipse(const QRectF& rect) override;
+	void drawPath(const QPainterPath& path) override;
+	void drawImage(const QRectF& rect, const QImage& image, const QRectF& sr) override;
+	void drawPixmap(const QRectF& rect, const QPixmap& pixmap, const QRectF& sr) override;
+	void drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p) override;
+	void drawText(const QPointF& p, const QString& text, const QFont& font) override;
+};
+
+// Flat display list of paint engine primitives and state changes. Commands and their point
+// data live in one arena, implicitly shared Qt values (pens, paths, images...) are kept in
+// side tables and referenced by index. clear() keeps every allocation, so recording the same
+// scene again does not allocate once the buffers have grown.
+class Direct2DCommandBuffer
+{
+public:
+	enum class Command : quint16
+	{
+		SetPen,
+		SetBrush,
+		SetBrushOrigin,
+		SetTransform,
+		SetRenderHints,
+		SetCompositionMode,
+		SetOpacity,
+		SetClipRegion,
+		SetClipPath,
+		SetClipEnabled,
+		DrawLines,
+		DrawRects,
+		DrawPoints,
+		DrawPolygon,
+		DrawEllipse,
+		DrawPath,
+		DrawImage,
+		DrawPixmap,
+		DrawTiledPixmap,
+		DrawText
+	};
+
+private:
+	struct header
+	{
+		quint16 command;
+		quint16 flags;
+		quint32 size; // header and payload, multiple of 8
+	};
+
+	std::vector<quint8> m_data;
+	std::vector<QPen> m_pens;
+	std::vector<QBrush> m_brushes;
+	std::vector<QPainterPath> m_paths;
+	std::vector<QRegion> m_regions;
+	std::vector<QImage> m_images;
+	std::vector<QPixmap> m_pixmaps;
+	std::vector<QString> m_texts;
+	std::vector<QFont> m_fonts;
+	int m_commandCount;
+
+	quint8* allocate(Command command, size_t payloadSize, quint16 flags = 0);
+	template<class T>
+	T* allocateArray(Command command, int count, quint16 flags = 0);
+	template<class T>
+	static quint32 pushIndex(std::vector<T>& table, const T& value);
+	template<class T>
+	static quint32 pushValue(std::vector<T>& table, const T& value);
+
+public:
+	Direct2DCommandBuffer();
+
+	void clear();
+	inline bool isEmpty() const { return m_data.empty(); }
+	inline int commandCount() const { return m_commandCount; }
+	inline size_t byteSize() const { return m_data.size(); }
+
+	void setPen(const QPen& pen);
+	void setBrush(const QBrush& brush);
+	void setBrushOrigin(const QPointF& origin);
+	void setTransform(const QTransform& transform);
+	void setRenderHints(QPainter::RenderHints hints);
+	void setCompositionMode(QPainter::CompositionMode mode);
+	void setOpacity(qreal opacity);
+	void setClipRegion(const QRegion& region, Qt::ClipOperation op);
+	void setClipPath(const QPainterPath& path, Qt::ClipOperation op);
+	void setClipEnabled(bool enabled);
+
+	void drawLines(const QLineF* lines, int lineCount);
+	void drawLines(const QLine* lines, int lineCount);
+	void drawRects(const QRectF* rects, int rectCount);
+	void drawRects(const QRect* rects, int rectCount);
+	void drawPoints(const QPointF* points, int pointCount);
+	void drawPoints(const QPoint* points, int pointCount);
+	void drawPolygon(const QPointF* points, int pointCount, QPaintEngine::PolygonDrawMode mode);
+	void drawPolygon(const QPoint* points, int pointCount, QPaintEngine::PolygonDrawMode mode);
+	void drawEllipse(const QRectF& rect);
+	void drawPath(const QPainterPath& path);
+	void drawImage(const QRectF& rect, const QImage& image, const QRectF& sr);
+	void drawPixmap(const QRectF& rect, const QPixmap& pixmap, const QRectF& sr);
+	void drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p);
+	void drawText(const QPointF& p, const QString& text, const QFont& font);
+
+	void replay(Direct2DCommandSink& sink) const;
+	void replay(QPainter& painter) const;
+};
+
+// Paint engine that records everything QPainter sends into a Direct2DCommandBuffer.
+class Direct2DRecordingEngine final : public QPaintEngine
+{
+private:
+	Direct2DCommandBuffer* m_buffer;
+
+public:
+	explicit Direct2DRecordingEngine(Direct2DCommandBuffer* buffer);
+
+	bool begin(QPaintDevice* pdev) override;
+	bool end() override;
+	void updateState(const QPaintEngineState& sstate) override;
+	QPaintEngine::Type type() const override;
+	void drawPixmap(const QRectF& r, const QPixmap& pm, const QRectF& sr) override;
+	void drawEllipse(const QRectF& rect) override;
+	void drawEllipse(const QRect& rect) override;
+	void drawImage(const QRectF& rectangle,
+		const QImage& image,
+		const QRectF& sr,
+		Qt::ImageConversionFlags flags = Qt::AutoColor) override;
+	void drawLines(const QLineF* lines, int lineCount) override;
+	void drawLines(const QLine* lines, int lineCount) override;
+	void drawPath(const QPainterPath& path) override;
+	void drawPoints(const QPointF* points, int pointCount) override;
+	void drawPoints(const QPoint* points, int pointCount) override;
+	void drawPolygon(const QPointF* points,
+		int pointCount,
+		QPaintEngine::PolygonDrawMode mode) override;
+	void drawPolygon(const QPoint* points,
+		int pointCount,
+		QPaintEngine::PolygonDrawMode mode) override;
+	void drawRects(const QRectF* rects, int rectCount) override;
+	void drawRects(const QRect* rects, int rectCount) override;
+	void drawTextItem(const QPointF& p, const QTextItem& textItem) override;
+	void drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p) override;
+};
+
+// Paint device to point a QPainter at for recording, e.g. to cache the output of an
+// expensive paintEvent and replay it later.
+class Direct2DRecordingDevice : public QPaintDevice
+{
+private:
+	QSize m_size;
+	int m_dpi;
+	Direct2DCommandBuffer m_commands;
+	QScopedPointer<Direct2DRecordingEngine> engine;
+
+protected:
+	int metric(PaintDeviceMetric metric) const override;
+
+public:
+	explicit Direct2DRecordingDevice(const QSize& size, int dpi = 96);
+	~Direct2DRecordingDevice();
+	QPaintEngine* paintEngine() const override;
+	inline QSize size() const { return m_size; }
+	inline void setSize(const QSize& size) { m_size = size; }
+	inline Direct2DCommandBuffer& commands() { return m_commands; }
+	inline const Direct2DCommandBuffer& commands() const { return m_commands; }
+};
+
+#endif // DIRECT2DCOMMANDBUFFER_H
@@ -0,0 +1,354 @@
+// Checks that a Direct2DCommandBuffer replays every recorded primitive and state change in
+// order and with the payload it was recorded with, also after clear(), and that recording
+// through QPainter puts the state a primitive needs before it. Only depends on QtGui, build it
+// with direct2dcommandbuffer.cpp and run it anywhere (QT_QPA_PLATFORM defaults to offscreen).
+// Exits with 0 when every check passes.
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QPixmap>
+#include <QStringList>
+#include <cstdio>
+#include "src/direct2d/direct2dcommandbuffer.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+	if (!ok) {
+		std::printf("%s\n", what);
+		failures++;
+	}
+}
+
+static QString str(const QPointF& p)
+{
+	return QString::asprintf("%g,%g", p.x(), p.y());
+}
+
+static QString str(const QRectF& r)
+{
+	return QString::asprintf("%g,%g %gx%g", r.x(), r.y(), r.width(), r.height());
+}
+
+// Logs every call with its payload and counts the calls of each command.
+class CountingSink final : public Direct2DCommandSink
+{
+public:
+	QStringList log;
+	int counts[int(Direct2DCommandBuffer::Command::DrawText) + 1] = {};
+
+	inline int count(Direct2DCommandBuffer::Command command) const { return counts[int(command)]; }
+
+private:
+	void add(Direct2DCommandBuffer::Command command, const QString& entry)
+	{
+		counts[int(command)]++;
+		log += entry;
+	}
+
+	template<class T, class Format>
+	void addArray(Direct2DCommandBuffer::Command command,
+		const char* name,
+		const T* items,
+		int count,
+		Format format)
+	{
+		QString entry = QString::asprintf("%s %d", name, count);
+		for (int i = 0; i < count; ++i)
+			entry += QLatin1Char(' ') + format(items[i]);
+		add(command, entry);
+	}
+
+public:
+	void setPen(const QPen& pen) override
+	{
+		add(Direct2DCommandBuffer::Command::SetPen,
+			QString::asprintf("pen %s %g %d", qPrintable(pen.color().name()), pen.widthF(), int(pen.style())));
+	}
+	void setBrush(const QBrush& brush) override
+	{
+		add(Direct2DCommandBuffer::Command::SetBrush,
+			QString::asprintf("brush %s %d", qPrintable(brush.color().name()), int(brush.style())));
+	}
+	void setBrushOrigin(const QPointF& origin) override
+	{
+		add(Direct2DCommandBuffer::Command::SetBrushOrigin, "origin " + str(origin));
+	}
+	void setTransform(const QTransform& t) override
+	{
+		add(Direct2DCommandBuffer::Command::SetTransform,
+			QString::asprintf("transform %g %g %g %g %g %g %g %g %g",
+				t.m11(), t.m12(), t.m13(), t.m21(), t.m22(), t.m23(), t.m31(), t.m32(), t.m33()));
+	}
+	void setRenderHints(QPainter::RenderHints hints) override
+	{
+		add(Direct2DCommandBuffer::Command::SetRenderHints, QString::asprintf("hints %#x", unsigned(hints.toInt())));
+	}
+	void setCompositionMode(QPainter::CompositionMode mode) override
+	{
+		add(Direct2DCommandBuffer::Command::SetCompositionMode, QString::asprintf("composition %d", int(mode)));
+	}
+	void setOpacity(qreal opacity) override
+	{
+		add(Direct2DCommandBuffer::Command::SetOpacity, QString::asprintf("opacity %g", opacity));
+	}
+	void setClipRegion(const QRegion& region, Qt::ClipOperation op) override
+	{
+		add(Direct2DCommandBuffer::Command::SetClipRegion,
+			QString::asprintf("clip region %d %d ", region.rectCount(), int(op)) + str(region.boundingRect()));
+	}
+	void setClipPath(const QPainterPath& path, Qt::ClipOperation op) override
+	{
+		add(Direct2DCommandBuffer::Command::SetClipPath,
+			QString::asprintf("clip path %d %d ", path.elementCount(), int(op)) + str(path.boundingRect()));
+	}
+	void setClipEnabled(bool enabled) override
+	{
+		add(Direct2DCommandBuffer::Command::SetClipEnabled, QString::asprintf("clip enabled %d", int(enabled)));
+	}
+	void drawLines(const QLineF* lines, int lineCount) override
+	{
+		addArray(Direct2DCommandBuffer::Command::DrawLines, "lines", lines, lineCount, [](const QLineF& l) {
+			return str(l.p1()) + QLatin1Char('-') + str(l.p2());
+		});
+	}
+	void drawRects(const QRectF* rects, int rectCount) override
+	{
+		addArray(Direct2DCommandBuffer::Command::DrawRects, "rects", rects, rectCount, [](const QRectF& r) {
+			return str(r);
+		});
+	}
+	void drawPoints(const QPointF* points, int pointCount) override
+	{
+		addArray(Direct2DCommandBuffer::Command::DrawPoints, "points", points, pointCount, [](const QPointF& p) {
+			return str(p);
+		});
+	}
+	void drawPolygon(const QPointF* points, int pointCount, QPaintEngine::PolygonDrawMode mode) override
+	{
+		const QByteArray name = "polygon " + QByteArray::number(int(mode));
+		addArray(Direct2DCommandBuffer::Command::DrawPolygon, name.constData(), points, pointCount, [](const QPointF& p) {
+			return str(p);
+		});
+	}
+	void drawEllipse(const QRectF& rect) override
+	{
+		add(Direct2DCommandBuffer::Command::DrawEllipse, "ellipse " + str(rect));
+	}
+	void drawPath(const QPainterPath& path) override
+	{
+		add(Direct2DCommandBuffer::Command::DrawPath,
+			QString::asprintf("path %d ", path.elementCount()) + str(path.boundingRect()));
+	}
+	void drawImage(const QRectF& rect, const QImage& image, const QRectF& sr) override
+	{
+		add(Direct2DCommandBuffer::Command::DrawImage,
+			QString::asprintf("image %lld ", image.cacheKey()) + str(rect) + " from " + str(sr));
+	}
+	void drawPixmap(const QRectF& rect, const QPixmap& pixmap, const QRectF& sr) override
+	{
+		add(Direct2DCommandBuffer::Command::DrawPixmap,
+			QString::asprintf("pixmap %lld ", pixmap.cacheKey()) + str(rect) + " from " + str(sr));
+	}
+	void drawTiledPixmap(const QRectF& rect, const QPixmap& pixmap, const QPointF& p) override
+	{
+		add(Direct2DCommandBuffer::Command::DrawTiledPixmap,
+			QString::asprintf("tiled %lld ", pixmap.cacheKey()) + str(rect) + " at " + str(p));
+	}
+	void drawText(const QPointF& p, const QString& text, const QFont& font) override
+	{
+		add(Direct2DCommandBuffer::Command::DrawText,
+			"text " + str(p) + QLatin1Char(' ') + text + QLatin1Char(' ') + font.family());
+	}
+};
+
+static void compare(const QStringList& actual, const QStringList& expected, const char* what)
+{
+	if (actual == expected)
+		return;
+	failures++;
+	for (int i = 0; i < qMax(actual.size(), expected.size()); ++i) {
+		const QString a = i < actual.size() ? actual[i] : QStringLiteral("<none>");
+		const QString e = i < expected.size() ? expected[i] : QStringLiteral("<none>");
+		if (a != e) {
+			std::printf("%s: command %d is \"%s\", expected \"%s\"\n", what, i, qPrintable(a), qPrintable(e));
+			return;
+		}
+	}
+}
+
+struct Resources
+{
+	QImage image{ 8, 4, QImage::Format_ARGB32_Premultiplied };
+	QPixmap pixmap{ 4, 4 };
+	QPainterPath path;
+	QFont font{ QStringLiteral("Arial") };
+
+	Resources()
+	{
+		image.fill(Qt::red);
+		pixmap.fill(Qt::blue);
+		path.addEllipse(QRectF(0, 0, 10, 20));
+	}
+};
+
+// one of every command, the integer overloads too, and the log the replay has to produce
+static QStringList recordAll(Direct2DCommandBuffer& buffer, const Resources& r)
+{
+	const QLineF lines[] = { QLineF(0, 0, 10, 10), QLineF(1.5, 2, 3, 4.25) };
+	const QLine intLines[] = { QLine(1, 2, 3, 4) };
+	const QRectF rects[] = { QRectF(0, 0, 5, 6), QRectF(-1, -2, 0.5, 0.25) };
+	const QRect intRects[] = { QRect(1, 2, 3, 4) };
+	const QPointF points[] = { QPointF(0.5, 0.5), QPointF(9, 8), QPointF(7, 6) };
+	const QPoint intPoints[] = { QPoint(3, 4) };
+
+	buffer.setPen(QPen(Qt::green, 2.5, Qt::DashLine));
+	buffer.setBrush(QBrush(Qt::yellow, Qt::Dense4Pattern));
+	buffer.setBrushOrigin(QPointF(3, 4));
+	buffer.setTransform(QTransform(1, 2, 0, 3, 4, 0, 5, 6, 1));
+	buffer.setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
+	buffer.setCompositionMode(QPainter::CompositionMode_Multiply);
+	buffer.setOpacity(0.5);
+	buffer.setClipRegion(QRegion(0, 0, 20, 10) + QRegion(30, 0, 5, 5), Qt::IntersectClip);
+	buffer.setClipPath(r.path, Qt::ReplaceClip);
+	buffer.setClipEnabled(false);
+	buffer.drawLines(lines, 2);
+	buffer.drawLines(intLines, 1);
+	buffer.drawRects(rects, 2);
+	buffer.drawRects(intRects, 1);
+	buffer.drawPoints(points, 3);
+	buffer.drawPoints(intPoints, 1);
+	buffer.drawPolygon(points, 3, QPaintEngine::WindingMode);
+	buffer.drawPolygon(intPoints, 1, QPaintEngine::PolylineMode);
+	buffer.drawEllipse(QRectF(1, 2, 3, 4));
+	buffer.drawPath(r.path);
+	buffer.drawImage(QRectF(0, 0, 16, 8), r.image, QRectF(0, 0, 8, 4));
+	buffer.drawPixmap(QRectF(2, 2, 4, 4), r.pixmap, QRectF(1, 1, 2, 2));
+	buffer.drawTiledPixmap(QRectF(0, 0, 40, 40), r.pixmap, QPointF(1, 2));
+	buffer.drawText(QPointF(5, 6), QStringLiteral("label"), r.font);
+	// empty arrays are commands too
+	buffer.drawLines(lines, 0);
+
+	const QString image = QString::number(r.image.cacheKey());
+	const QString pixmap = QString::number(r.pixmap.cacheKey());
+	return {
+		QStringLiteral("pen #00ff00 2.5 2"),
+		QStringLiteral("brush #ffff00 5"),
+		QStringLiteral("origin 3,4"),
+		QStringLiteral("transform 1 2 0 3 4 0 5 6 1"),
+		QString::asprintf("hints %#x", unsigned((QPainter::Antialiasing | QPainter::SmoothPixmapTransform).toInt())),
+		QString::asprintf("composition %d", int(QPainter::CompositionMode_Multiply)),
+		QStringLiteral("opacity 0.5"),
+		QString::asprintf("clip region 2 %d 0,0 35x10", int(Qt::IntersectClip)),
+		QString::asprintf("clip path %d %d 0,0 10x20", r.path.elementCount(), int(Qt::ReplaceClip)),
+		QStringLiteral("clip enabled 0"),
+		QStringLiteral("lines 2 0,0-10,10 1.5,2-3,4.25"),
+		QStringLiteral("lines 1 1,2-3,4"),
+		QStringLiteral("rects 2 0,0 5x6 -1,-2 0.5x0.25"),
+		QStringLiteral("rects 1 1,2 3x4"),
+		QStringLiteral("points 3 0.5,0.5 9,8 7,6"),
+		QStringLiteral("points 1 3,4"),
+		QString::asprintf("polygon %d 3 0.5,0.5 9,8 7,6", int(QPaintEngine::WindingMode)),
+		QString::asprintf("polygon %d 1 3,4", int(QPaintEngine::PolylineMode)),
+		QStringLiteral("ellipse 1,2 3x4"),
+		QString::asprintf("path %d 0,0 10x20", r.path.elementCount()),
+		"image " + image + " 0,0 16x8 from 0,0 8x4",
+		"pixmap " + pixmap + " 2,2 4x4 from 1,1 2x2",
+		"tiled " + pixmap + " 0,0 40x40 at 1,2",
+		"text 5,6 label " + r.font.family(),
+		QStringLiteral("lines 0"),
+	};
+}
+
+static void checkReplay()
+{
+	const Resources resources;
+	Direct2DCommandBuffer buffer;
+	check(buffer.isEmpty() && buffer.commandCount() == 0, "a new buffer is not empty");
+
+	const QStringList expected = recordAll(buffer, resources);
+	check(buffer.commandCount() == expected.size(), "command count differs from the commands recorded");
+
+	CountingSink sink;
+	buffer.replay(sink);
+	compare(sink.log, expected, "replay");
+	check(sink.count(Direct2DCommandBuffer::Command::DrawLines) == 3, "replay: wrong number of drawLines");
+	check(sink.count(Direct2DCommandBuffer::Command::DrawRects) == 2, "replay: wrong number of drawRects");
+	check(sink.count(Direct2DCommandBuffer::Command::DrawPolygon) == 2, "replay: wrong number of drawPolygon");
+	check(sink.count(Direct2DCommandBuffer::Command::SetPen) == 1, "replay: wrong number of setPen");
+
+	// replaying does not consume the buffer
+	CountingSink again;
+	buffer.replay(again);
+	compare(again.log, expected, "second replay");
+
+	// clear() keeps the allocations but none of the commands or side table entries
+	const size_t bytes = buffer.byteSize();
+	buffer.clear();
+	check(buffer.isEmpty() && buffer.commandCount() == 0 && buffer.byteSize() == 0, "clear kept commands");
+	CountingSink cleared;
+	buffer.replay(cleared);
+	check(cleared.log.isEmpty(), "a cleared buffer replays commands");
+
+	const QLineF line(4, 5, 6, 7);
+	buffer.setPen(QPen(Qt::blue, 1));
+	buffer.drawLines(&line, 1);
+	CountingSink reused;
+	buffer.replay(reused);
+	compare(reused.log, { QStringLiteral("pen #0000ff 1 1"), QStringLiteral("lines 1 4,5-6,7") }, "reuse after clear");
+
+	// recording the same scene again gives the same bytes and the same replay
+	buffer.clear();
+	recordAll(buffer, resources);
+	check(buffer.byteSize() == bytes, "recording again after clear changed the size");
+	CountingSink rerecorded;
+	buffer.replay(rerecorded);
+	compare(rerecorded.log, expected, "replay after clear");
+}
+
+// QPainter only flushes state to the engine when a primitive needs it
+static void checkRecordingDevice()
+{
+	Direct2DRecordingDevice device(QSize(100, 100));
+	{
+		QPainter painter(&device);
+		painter.setPen(QPen(Qt::red, 3));
+		painter.setBrush(Qt::NoBrush);
+		painter.drawLine(QLineF(0, 0, 10, 0));
+		painter.translate(5, 6);
+		painter.setClipRect(QRectF(0, 0, 50, 50));
+		painter.drawEllipse(QRectF(1, 1, 8, 8));
+	}
+
+	CountingSink sink;
+	device.commands().replay(sink);
+	const int pen = int(sink.log.indexOf(QStringLiteral("pen #ff0000 3 1")));
+	const int line = int(sink.log.indexOf(QStringLiteral("lines 1 0,0-10,0")));
+	const int transform = int(sink.log.indexOf(QStringLiteral("transform 1 0 0 0 1 0 5 6 1")));
+	int clip = -1;
+	for (int i = 0; i < sink.log.size(); ++i) {
+		if (sink.log[i].startsWith(QLatin1String("clip ")))
+			clip = i;
+	}
+	const int ellipse = int(sink.log.indexOf(QStringLiteral("ellipse 1,1 8x8")));
+	check(pen >= 0 && line > pen, "recording: the pen does not come before the line");
+	check(transform > line && clip > transform, "recording: the clip does not follow its transform");
+	check(ellipse > clip, "recording: the ellipse does not come after its clip");
+	check(sink.count(Direct2DCommandBuffer::Command::DrawLines) == 1
+			&& sink.count(Direct2DCommandBuffer::Command::DrawEllipse) == 1,
+		"recording: wrong number of primitives");
+	check(device.commands().commandCount() == sink.log.size(), "recording: command count differs from the replay");
+}
+
+int main(int argc, char* argv[])
+{
+	if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	QGuiApplication app(argc, argv);
+
+	checkReplay();
+	checkRecordingDevice();
+	std::printf("command buffer: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
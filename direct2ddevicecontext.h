@@ -15,6 +15,9 @@ class IDirect2DDeviceContext
 {
 protected:
 	ComPtr<ID2D1DEVICECONTEXT> m_context;
+	// set by the device while a partial repaint is painted, the engine clips to it
+	D2D1_RECT_F m_updateRect = {};
+	bool m_hasUpdateRect = false;
 	virtual void recreateTarget() = 0;
 public:
 	inline void begin() { m_context->BeginDraw(); };
@@ -27,6 +30,7 @@ public:
 		return true;
 	};
 	inline ID2D1DEVICECONTEXT* dc() { return m_context.Get(); }
+	inline const D2D1_RECT_F* updateRect() const { return m_hasUpdateRect ? &m_updateRect : nullptr; }
 
 };
 #endif // DIRECT2DDEVICECONTEXT_H
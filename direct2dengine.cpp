@@ -1,114 +1,147 @@
 #include "direct2dengine.h"
 #include <QGlyphRun>
 #include <QRawFont>
+#include <QtMath>
 #include <QVarLengthArray>
 #include "direct2dqthelper.h"
 #include "directcontext.h"
 #include "qpainterpath.h"
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
 #include <comdef.h>
 #include <dwrite.h>
 #include <qglobal.h>
 #include <wingdi.h>
 
-#define UNUSED(A) void(A)
+// Counting policy of the frame stats. Only this file reads DIRECT2D_ENGINE_STATS, define it
+// for the build of the engine; the engine layout is the same either way.
+#ifndef DIRECT2D_ENGINE_STATS
+#define DIRECT2D_ENGINE_STATS 0
+#endif
+using Direct2DEngineCounters = Direct2DFrameCounters<DIRECT2D_ENGINE_STATS != 0>;
 
-ComPtr<ID2D1Bitmap> Direct2DPaintEngine::QPixmapToD2D1Bitmap(const QPixmap& pixmap)
+static inline Direct2DEngineCounters counters(Direct2DFrameCounterState& state)
 {
-	QImage image = pixmap.toImage();
-	return fromImage(image);
+	return Direct2DEngineCounters(state);
 }
 
+#define UNUSED(A) void(A)
+
 void Direct2DPaintEngine::updateBrush(const QBrush& brush, bool force)
 {
-	if (force || m_brush.qbrush != brush) {
-		m_brush.brush.Reset();
-		m_brush.brush = toD2dBrush(brush);
-		if (m_brush.brush)
-			m_brush.brush->SetOpacity((FLOAT)state->opacity());
+	if (force || m_brush.qbrush != brush || m_brush.opacity != state->opacity()) {
 		m_brush.qbrush = brush;
+		m_brush.opacity = state->opacity();
+		m_brush.brush = cachedBrush(brush, currentBrushOrigin);
 	}
 }
 
 void Direct2DPaintEngine::updatePen(const QPen& newPen, bool force)
 {
-	if (force || m_pen.qpen != newPen) {
+	if (force || m_pen.qpen != newPen || m_pen.opacity != state->opacity()) {
 		m_pen.qpen = newPen;
+		m_pen.opacity = state->opacity();
 		m_pen.reset();
 
 		if (newPen.style() == Qt::NoPen)
 			return;
 
-		m_pen.brush = toD2dBrush(newPen.brush());
+		m_pen.brush = cachedBrush(newPen.brush(), QPointF());
 		if (!m_pen.brush)
 			return;
 
-		m_pen.brush->SetOpacity(FLOAT(state->opacity()));
-
-		D2D1_STROKE_STYLE_PROPERTIES1 props = {};
+		m_pen.strokeStyle = cachedStrokeStyle(Direct2DStrokeKey(newPen));
+	}
+}
 
-		switch (newPen.capStyle()) {
-		case Qt::SquareCap:
-			props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_SQUARE;
-			break;
-		case Qt::RoundCap:
-			props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_ROUND;
-			break;
-		case Qt::FlatCap:
-		default:
-			props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_FLAT;
-			break;
-		}
+ComPtr<ID2D1StrokeStyle1> Direct2DPaintEngine::cachedStrokeStyle(const Direct2DStrokeKey& key)
+{
+	Direct2DStrokeStyleCache& cache = DirectContext::instance().strokeStyleCache();
+	if (std::optional<ComPtr<ID2D1StrokeStyle1>> cached = cache.find(key))
+		return *cached;
 
-		switch (newPen.joinStyle()) {
-		case Qt::BevelJoin:
-			props.lineJoin = D2D1_LINE_JOIN_BEVEL;
-			break;
-		case Qt::RoundJoin:
-			props.lineJoin = D2D1_LINE_JOIN_ROUND;
-			break;
-		case Qt::MiterJoin:
-		default:
-			props.lineJoin = D2D1_LINE_JOIN_MITER;
-			break;
-		}
+	D2D1_STROKE_STYLE_PROPERTIES1 props = {};
 
-		props.miterLimit = FLOAT(newPen.miterLimit() * qreal(2.0)); // D2D and Qt miter specs differ
-		props.dashOffset = FLOAT(newPen.dashOffset());
+	switch (key.cap) {
+	case Qt::SquareCap:
+		props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_SQUARE;
+		break;
+	case Qt::RoundCap:
+		props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_ROUND;
+		break;
+	case Qt::FlatCap:
+	default:
+		props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_FLAT;
+		break;
+	}
 
-		if (newPen.widthF() == 0)
-			props.transformType = D2D1_STROKE_TRANSFORM_TYPE_HAIRLINE;
-		else if (newPen.isCosmetic())
-			props.transformType = D2D1_STROKE_TRANSFORM_TYPE_FIXED;
-		else
-			props.transformType = D2D1_STROKE_TRANSFORM_TYPE_NORMAL;
+	switch (key.join) {
+	case Qt::BevelJoin:
+		props.lineJoin = D2D1_LINE_JOIN_BEVEL;
+		break;
+	case Qt::RoundJoin:
+		props.lineJoin = D2D1_LINE_JOIN_ROUND;
+		break;
+	case Qt::MiterJoin:
+	default:
+		props.lineJoin = D2D1_LINE_JOIN_MITER;
+		break;
+	}
 
-		switch (newPen.style()) {
-		case Qt::SolidLine:
-			props.dashStyle = D2D1_DASH_STYLE_SOLID;
-			break;
+	props.miterLimit = FLOAT(key.miterLimit * qreal(2.0)); // D2D and Qt miter specs differ
+	props.dashOffset = FLOAT(key.dashOffset);
 
-		case Qt::DashLine:
-		case Qt::DotLine:
-		case Qt::DashDotLine:
-		case Qt::DashDotDotLine:
-			if (newPen.widthF() <= 1.0)
-				props.startCap = props.endCap = props.dashCap = D2D1_CAP_STYLE_FLAT;
+	switch (key.transform) {
+	case Direct2DStrokeKey::Hairline:
+		props.transformType = D2D1_STROKE_TRANSFORM_TYPE_HAIRLINE;
+		break;
+	case Direct2DStrokeKey::Fixed:
+		props.transformType = D2D1_STROKE_TRANSFORM_TYPE_FIXED;
+		break;
+	case Direct2DStrokeKey::Normal:
+	default:
+		props.transformType = D2D1_STROKE_TRANSFORM_TYPE_NORMAL;
+		break;
+	}
 
-			props.dashStyle = (D2D1_DASH_STYLE)(newPen.style() - 1);
+	// both Qt and D2D express dash lengths in units of the stroke width
+	QVarLengthArray<FLOAT> dashes;
+	switch (key.style) {
+	case Qt::SolidLine:
+		props.dashStyle = D2D1_DASH_STYLE_SOLID;
+		break;
 
-			break;
-		default:
-			props.dashStyle = D2D1_DASH_STYLE_CUSTOM;
-			//TODO
-			break;
-		}
+	case Qt::DashLine:
+	case Qt::DotLine:
+	case Qt::DashDotLine:
+	case Qt::DashDotDotLine:
+		props.dashStyle = (D2D1_DASH_STYLE)(key.style - 1);
+		break;
 
-		HRESULT hr;
-		hr = factory()->CreateStrokeStyle(props, nullptr, 0, &m_pen.strokeStyle);
+	case Qt::CustomDashLine:
+	default:
+		props.dashStyle = D2D1_DASH_STYLE_CUSTOM;
+		for (qreal dash : key.dashes)
+			dashes.append(FLOAT(dash));
+		if (dashes.isEmpty())
+			props.dashStyle = D2D1_DASH_STYLE_SOLID;
+		break;
+	}
 
-		if (FAILED(hr))
-			qWarning("%s: Could not create stroke style: %#lx", __FUNCTION__, hr);
+	ComPtr<ID2D1StrokeStyle1> strokeStyle;
+	HRESULT hr = factory()->CreateStrokeStyle(props,
+		dashes.isEmpty() ? nullptr : dashes.constData(),
+		UINT32(dashes.size()),
+		&strokeStyle);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create stroke style: %#lx", __FUNCTION__, hr);
+		return nullptr;
 	}
+	counters(m_stats).strokeStyleCreated();
+
+	cache.insert(key, strokeStyle);
+	return strokeStyle;
 }
 
 void Direct2DPaintEngine::initBrushAndPen()
@@ -121,6 +154,17 @@ Direct2DPaintEngine::Direct2DPaintEngine(IDirect2DDeviceContext* rt,
 	QPaintEngine::PaintEngineFeatures caps)
 	: QPaintEngine(caps)
 	, d(rt)
+	, m_updateClipPushed(false)
+	, m_clipEnabled(false)
+	, m_clipDirty(false)
+	, m_realizationThreshold(0)
+	, m_lineBatchThreshold(64)
+	, m_pointBatchThreshold(256)
+	, m_polygonCacheThreshold(16)
+	, m_shapeBatchThreshold(256)
+#ifndef __MINGW64__
+	, m_markers(32)
+#endif
 {
 	QPaintEngine::PaintEngineFeatures unsupported = QPaintEngine::PorterDuff
 		| QPaintEngine::BlendModes
@@ -154,6 +198,13 @@ bool Direct2DPaintEngine::begin(QPaintDevice* pdev)
 		return false;
 	d->begin();
 	d->dc()->SetTransform(D2D1::Matrix3x2F::Identity());
+	m_clipStack.clear();
+	m_clipEnabled = false;
+	m_clipDirty = false;
+	m_updateClipPushed = d->updateRect() != nullptr;
+	if (m_updateClipPushed)
+		d->dc()->PushAxisAlignedClip(*d->updateRect(), D2D1_ANTIALIAS_MODE_ALIASED);
+	counters(m_stats).beginFrame();
 	initBrushAndPen();
 	setActive(true);
 	return true;
@@ -161,7 +212,29 @@ bool Direct2DPaintEngine::begin(QPaintDevice* pdev)
 
 bool Direct2DPaintEngine::end()
 {
-	return d->end();
+	// clips must be popped in reverse order of their pushes, the update clip is at the bottom
+	popClips(0);
+	if (m_updateClipPushed) {
+		d->dc()->PopAxisAlignedClip();
+		m_updateClipPushed = false;
+	}
+	const bool result = d->end();
+	counters(m_stats).endFrame();
+	if (Direct2DEngineCounters::enabled && m_statsNotifier)
+		emit m_statsNotifier->frameFinished(m_stats.last);
+	return result;
+}
+
+bool Direct2DPaintEngine::hasFrameStats()
+{
+	return Direct2DEngineCounters::enabled;
+}
+
+Direct2DFrameStatsNotifier* Direct2DPaintEngine::frameStatsNotifier()
+{
+	if (!m_statsNotifier)
+		m_statsNotifier.reset(new Direct2DFrameStatsNotifier);
+	return m_statsNotifier.get();
 }
 
 static QList<D2D1_GRADIENT_STOP> qGradientStopsToD2DStops(const QGradientStops& qstops)
@@ -331,8 +404,7 @@ ComPtr<ID2D1Brush> Direct2DPaintEngine::toD2dBrush(const QBrush& newBrush)
 															   D2D1_EXTEND_MODE_WRAP,
 															   interpolationMode() };
 
-		QImage i{ newBrush.texture().toImage() };
-		ComPtr<ID2D1Bitmap> bitmap = fromImage(i);
+		ComPtr<ID2D1Bitmap> bitmap = cachedBitmap(newBrush.texture());
 		if (!bitmap)
 			break;
 		hr = d->dc()->CreateBitmapBrush(bitmap.Get(), bitmapBrushProperties, &bitmapBrush);
@@ -354,25 +426,81 @@ ComPtr<ID2D1Brush> Direct2DPaintEngine::toD2dBrush(const QBrush& newBrush)
 	return result;
 }
 
+ComPtr<ID2D1Brush> Direct2DPaintEngine::cachedBrush(const QBrush& newBrush, const QPointF& origin)
+{
+	if (newBrush.style() == Qt::NoBrush)
+		return nullptr;
+
+	const Direct2DBrushKey key(newBrush,
+		state->opacity(),
+		origin,
+		state->renderHints() & QPainter::SmoothPixmapTransform);
+	Direct2DBrushCache& cache = DirectContext::instance().brushCache();
+	if (std::optional<ComPtr<ID2D1Brush>> cached = cache.find(key))
+		return *cached;
+
+	ComPtr<ID2D1Brush> result = toD2dBrush(newBrush);
+	if (!result)
+		return result;
+	counters(m_stats).brushCreated();
+
+	// opacity and origin are part of the key, the brush is not touched again once cached
+	result->SetOpacity(FLOAT(key.opacity));
+	if (!key.origin.isNull()) {
+		D2D1_MATRIX_3X2_F transform;
+		result->GetTransform(&transform);
+		result->SetTransform(*(D2D1::Matrix3x2F::ReinterpretBaseType(&transform))
+			* D2D1::Matrix3x2F::Translation(FLOAT(key.origin.x()), FLOAT(key.origin.y())));
+	}
+	cache.insert(key, result);
+	return result;
+}
+
 ComPtr<ID2D1Bitmap> Direct2DPaintEngine::fromImage(QImage& image)
 {
-	if (image.format() != QImage::Format_ARGB32_Premultiplied)
-		image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	return fromImage(image, image.physicalDpiX(), image.physicalDpiY());
+}
+
+ComPtr<ID2D1Bitmap> Direct2DPaintEngine::fromImage(QImage& image, FLOAT dpiX, FLOAT dpiY)
+{
+	// RGB32 is B8G8R8A8 with opaque alpha in memory, premultiplied or not makes no difference
+	const void* bits = image.constBits();
+	UINT32 pitch = UINT32(image.bytesPerLine());
+	std::vector<uint32_t> staging;
+	Direct2DPixelFormat format;
+	if (image.format() != QImage::Format_ARGB32_Premultiplied
+		&& image.format() != QImage::Format_RGB32) {
+		if (toDirect2DPixelFormat(image.format(), &format)) {
+			staging = m_staging.acquire(size_t(image.width()) * size_t(image.height()));
+			direct2dConvertImage(format,
+				image.constBits(),
+				size_t(image.bytesPerLine()),
+				staging.data(),
+				size_t(image.width()) * sizeof(uint32_t),
+				image.width(),
+				image.height());
+			bits = staging.data();
+			pitch = UINT32(image.width()) * sizeof(uint32_t);
+		}
+		else {
+			image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+			bits = image.constBits();
+			pitch = UINT32(image.bytesPerLine());
+		}
+	}
 
 	// Create a D2D1Bitmap from the QImage data
 	D2D1_SIZE_U size = { static_cast<UINT32>(image.width()), static_cast<UINT32>(image.height()) };
 	D2D1_BITMAP_PROPERTIES properties
 		= D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM,
 			D2D1_ALPHA_MODE_PREMULTIPLIED),
-			image.physicalDpiX(),
-			image.physicalDpiY());
+			dpiX,
+			dpiY);
 
 	ComPtr<ID2D1Bitmap> bitmap;
-	HRESULT hr = d->dc()->CreateBitmap(size,
-		image.constBits(),
-		image.bytesPerLine(),
-		&properties,
-		&bitmap);
+	HRESULT hr = d->dc()->CreateBitmap(size, bits, pitch, &properties, &bitmap);
+	if (!staging.empty())
+		m_staging.release(std::move(staging));
 	if (FAILED(hr)) {
 		return nullptr;
 	}
@@ -380,12 +508,44 @@ ComPtr<ID2D1Bitmap> Direct2DPaintEngine::fromImage(QImage& image)
 	return bitmap;
 }
 
-ComPtr<IDWriteFontFace> Direct2DPaintEngine::getFont()
+ComPtr<ID2D1Bitmap> Direct2DPaintEngine::cachedBitmap(const QImage& image)
+{
+	// uploaded at 96 DPI, where DIPs are pixels: DrawBitmap reads the source rect in DIPs and
+	// QPainter hands it over in image pixels
+	Direct2DBitmapKey key;
+	key.cacheKey = image.cacheKey();
+	if (std::optional<ComPtr<ID2D1Bitmap>> cached = DirectContext::instance().bitmapCache().find(key))
+		return *cached;
+	return uploadBitmap(key, image);
+}
+
+ComPtr<ID2D1Bitmap> Direct2DPaintEngine::cachedBitmap(const QPixmap& pixmap)
+{
+	Direct2DBitmapKey key;
+	key.cacheKey = pixmap.cacheKey();
+	key.pixmap = true;
+	if (std::optional<ComPtr<ID2D1Bitmap>> cached = DirectContext::instance().bitmapCache().find(key))
+		return *cached;
+	return uploadBitmap(key, pixmap.toImage());
+}
+
+ComPtr<ID2D1Bitmap> Direct2DPaintEngine::uploadBitmap(const Direct2DBitmapKey& key, QImage image)
 {
-	const QFont& font = state->font();
-	if (fontCache.contains(font))
-		return fontCache[font];
+	ComPtr<ID2D1Bitmap> bitmap = fromImage(image, key.dpiX, key.dpiY);
+	if (!bitmap)
+		return bitmap;
 
+	// device size, whatever the format the image came in
+	const size_t bytes = size_t(image.width()) * size_t(image.height()) * 4;
+	counters(m_stats).bitmapCreated(qint64(bytes));
+
+	// also drops the copy uploaded before a detached image changed
+	DirectContext::instance().bitmapCache().insert(key, bitmap, bytes);
+	return bitmap;
+}
+
+static ComPtr<IDWriteFontFace> createFontFace(const QFont& font)
+{
 	ComPtr<IDWriteFontFace> fontFace = nullptr;
 	LOGFONT lf;
 	memset(&lf, 0, sizeof(lf));
@@ -402,7 +562,7 @@ ComPtr<IDWriteFontFace> Direct2DPaintEngine::getFont()
 	lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
 	lf.lfQuality = CLEARTYPE_QUALITY;
 	lf.lfPitchAndFamily = DEFAULT_PITCH | FF_DONTCARE;
-	std::wstring fontWName = state->font().family().toStdWString();
+	std::wstring fontWName = font.family().toStdWString();
 	wcscpy_s(lf.lfFaceName, ARRAYSIZE(lf.lfFaceName), fontWName.data());
 	ComPtr<IDWriteFont> dwriteFont;
 	HRESULT hr = DirectContext::instance().IDWriteGdiInterop()->CreateFontFromLOGFONT(&lf,
@@ -431,8 +591,18 @@ ComPtr<IDWriteFontFace> Direct2DPaintEngine::getFont()
 		qDebug("%s: CreateFontFace failed: %#lx", __FUNCTION__, hr);
 		return fontFace;
 	}
-	fontCache[font] = fontFace;
+	return fontFace;
+}
 
+ComPtr<IDWriteFontFace> Direct2DPaintEngine::getFont(const QFont& font)
+{
+	Direct2DFontFaceCache& cache = DirectContext::instance().fontFaceCache();
+	if (std::optional<ComPtr<IDWriteFontFace>> cached = cache.find(font))
+		return *cached;
+
+	ComPtr<IDWriteFontFace> fontFace = createFontFace(font);
+	if (fontFace)
+		cache.insert(font, fontFace);
 	return fontFace;
 }
 
@@ -454,35 +624,35 @@ void Direct2DPaintEngine::updateCompositionMode(QPainter::CompositionMode mode)
 
 void Direct2DPaintEngine::updateBrushOrigin(const QPointF& brushOrigin)
 {
-	negateCurrentBrushOrigin();
-	applyBrushOrigin(brushOrigin);
-}
-
-void Direct2DPaintEngine::negateCurrentBrushOrigin()
-{
-	if (m_brush.brush && !currentBrushOrigin.isNull()) {
-		D2D1_MATRIX_3X2_F transform;
-		m_brush.brush->GetTransform(&transform);
-
-		m_brush.brush->SetTransform(*(D2D1::Matrix3x2F::ReinterpretBaseType(&transform))
-			* D2D1::Matrix3x2F::Translation(FLOAT(-currentBrushOrigin.x()),
-				FLOAT(-currentBrushOrigin.y())));
+	if (currentBrushOrigin != brushOrigin) {
+		currentBrushOrigin = brushOrigin;
+		updateBrush(m_brush.qbrush, true);
 	}
 }
 
-void Direct2DPaintEngine::applyBrushOrigin(const QPointF& origin)
+// QPainter::setClipRect(QRectF) reaches non-extended engines as QPainterPath::addRect
+static bool pathIsRect(const QPainterPath& path, QRectF* rect)
 {
-	if (m_brush.brush && !origin.isNull()) {
-		D2D1_MATRIX_3X2_F transform;
-		m_brush.brush->GetTransform(&transform);
-
-		m_brush.brush->SetTransform(
-			*(D2D1::Matrix3x2F::ReinterpretBaseType(&transform))
-			* D2D1::Matrix3x2F::Translation(FLOAT(origin.x()), FLOAT(origin.y())));
+	if (path.elementCount() != 5 || !path.elementAt(0).isMoveTo())
+		return false;
+	for (int i = 1; i < 5; i++) {
+		if (!path.elementAt(i).isLineTo())
+			return false;
 	}
 
-	currentBrushOrigin = origin;
+	const QPainterPath::Element& e0 = path.elementAt(0);
+	const QPainterPath::Element& e1 = path.elementAt(1);
+	const QPainterPath::Element& e2 = path.elementAt(2);
+	const QPainterPath::Element& e3 = path.elementAt(3);
+	const QPainterPath::Element& e4 = path.elementAt(4);
+	if (e0.y != e1.y || e1.x != e2.x || e2.y != e3.y || e3.x != e0.x || e4.x != e0.x
+		|| e4.y != e0.y)
+		return false;
+
+	*rect = QRectF(QPointF(e0.x, e0.y), QPointF(e2.x, e2.y)).normalized();
+	return true;
 }
+
 void Direct2DPaintEngine::updateState(const QPaintEngineState& sstate)
 {
 	if (sstate.state().testFlag(QPaintEngine::DirtyBrush)) {
@@ -491,6 +661,9 @@ void Direct2DPaintEngine::updateState(const QPaintEngineState& sstate)
 	if (sstate.state().testFlag(QPaintEngine::DirtyPen)) {
 		updatePen(sstate.pen());
 	}
+	if (sstate.state().testFlag(QPaintEngine::DirtyBrushOrigin)) {
+		updateBrushOrigin(sstate.brushOrigin());
+	}
 	if (sstate.state().testFlag(QPaintEngine::DirtyOpacity)) {
 		updateBrush(sstate.brush());
 		updatePen(sstate.pen());
@@ -502,166 +675,927 @@ void Direct2DPaintEngine::updateState(const QPaintEngineState& sstate)
 	}
 	if (sstate.state().testFlag(QPaintEngine::DirtyTransform)) {
 		d->dc()->SetTransform(toD2dMatrix3x2F(sstate.transform()));
+		counters(m_stats).transformChanged();
 	}
 	if (sstate.state().testFlag(QPaintEngine::DirtyHints)) {
 		d->dc()->SetAntialiasMode(antialiasMode());
+		counters(m_stats).antialiasChanged();
+		// SmoothPixmapTransform is part of the key of texture and gradient brushes
+		const Qt::BrushStyle brushStyle = m_brush.qbrush.style();
+		if (brushStyle != Qt::NoBrush && brushStyle != Qt::SolidPattern)
+			updateBrush(sstate.brush(), true);
+		const Qt::BrushStyle penStyle = m_pen.qpen.brush().style();
+		if (m_pen.qpen.style() != Qt::NoPen && penStyle != Qt::NoBrush && penStyle != Qt::SolidPattern)
+			updatePen(sstate.pen(), true);
+	}
+	// after the transform: a clip is recorded with the transform it was set under
+	if (sstate.state().testFlag(QPaintEngine::DirtyClipRegion)) {
+		clipEntry entry;
+		const QRegion region = sstate.clipRegion();
+		if (region.rectCount() == 1) {
+			entry.kind = clipEntry::Rect;
+			entry.rect = region.boundingRect();
+		}
+		else {
+			entry.kind = clipEntry::Region;
+			entry.region = region;
+		}
+		updateClip(std::move(entry), sstate.clipOperation());
+	}
+	if (sstate.state().testFlag(QPaintEngine::DirtyClipPath)) {
+		clipEntry entry;
+		QRectF rect;
+		if (pathIsRect(sstate.clipPath(), &rect)) {
+			entry.kind = clipEntry::Rect;
+			entry.rect = rect;
+		}
+		else {
+			entry.kind = clipEntry::Path;
+			entry.path = sstate.clipPath();
+		}
+		updateClip(std::move(entry), sstate.clipOperation());
+	}
+	if (sstate.state().testFlag(QPaintEngine::DirtyClipEnabled)) {
+		m_clipEnabled = sstate.isClipEnabled();
+		m_clipDirty = true;
+	}
+}
+
+void Direct2DPaintEngine::updateClip(clipEntry&& entry, Qt::ClipOperation operation)
+{
+	m_clipDirty = true;
+	if (operation == Qt::NoClip) {
+		m_clipStack.clear();
+		return;
+	}
+	if (operation == Qt::ReplaceClip)
+		m_clipStack.clear();
+
+	entry.matrix = state->transform();
+	entry.antialias = state->renderHints() & QPainter::Antialiasing;
+	m_clipStack.push_back(std::move(entry));
+}
+
+void Direct2DPaintEngine::syncClip()
+{
+	m_clipDirty = false;
+	const size_t wanted = m_clipEnabled ? m_clipStack.size() : 0;
+	size_t common = 0;
+	while (common < wanted && common < m_appliedClips.size()
+		&& m_appliedClips[common].entry == m_clipStack[common])
+		++common;
+
+	popClips(common);
+	if (common == wanted)
+		return;
+
+	// every clip is pushed under its own transform
+	D2D1_MATRIX_3X2_F transform;
+	d->dc()->GetTransform(&transform);
+	for (size_t i = common; i < wanted; i++)
+		pushClip(m_clipStack[i]);
+	d->dc()->SetTransform(transform);
+}
+
+void Direct2DPaintEngine::pushClip(const clipEntry& entry)
+{
+	appliedClip applied;
+	applied.entry = entry;
+	d->dc()->SetTransform(toD2dMatrix3x2F(entry.matrix));
+	const D2D1_ANTIALIAS_MODE mode = entry.antialias ? D2D1_ANTIALIAS_MODE_PER_PRIMITIVE
+													 : D2D1_ANTIALIAS_MODE_ALIASED;
+
+	// rectangles under scale and translation stay rectangles, no layer needed
+	if (entry.kind == clipEntry::Rect && entry.matrix.type() <= QTransform::TxScale) {
+		d->dc()->PushAxisAlignedClip(toD2dRectF(entry.rect), mode);
+		applied.type = appliedClip::AxisAligned;
+		m_appliedClips.push_back(std::move(applied));
+		return;
 	}
+
+	applied.mask = clipMask(entry);
+	if (applied.mask) {
+		if (!m_layerPool.empty()) {
+			applied.layer = std::move(m_layerPool.back());
+			m_layerPool.pop_back();
+		}
+		else {
+			HRESULT hr = d->dc()->CreateLayer(nullptr, &applied.layer);
+			if (FAILED(hr))
+				qWarning("%s: Could not create clip layer: %#lx", __FUNCTION__, hr);
+		}
+	}
+
+	if (applied.layer) {
+		d->dc()->PushLayer(D2D1::LayerParameters1(D2D1::InfiniteRect(),
+							   applied.mask.Get(),
+							   mode,
+							   D2D1::IdentityMatrix(),
+							   1.0f,
+							   nullptr,
+							   D2D1_LAYER_OPTIONS1_NONE),
+			applied.layer.Get());
+		applied.type = appliedClip::Layer;
+	}
+	m_appliedClips.push_back(std::move(applied));
+}
+
+void Direct2DPaintEngine::popClips(size_t count)
+{
+	while (m_appliedClips.size() > count) {
+		appliedClip& applied = m_appliedClips.back();
+		if (applied.type == appliedClip::AxisAligned) {
+			d->dc()->PopAxisAlignedClip();
+		}
+		else if (applied.type == appliedClip::Layer) {
+			d->dc()->PopLayer();
+			m_layerPool.push_back(std::move(applied.layer));
+		}
+		m_appliedClips.pop_back();
+	}
+}
+
+ComPtr<ID2D1Geometry> Direct2DPaintEngine::clipMask(const clipEntry& entry)
+{
+	HRESULT hr;
+	switch (entry.kind) {
+	case clipEntry::Rect: {
+		ComPtr<ID2D1RectangleGeometry> rect;
+		hr = factory()->CreateRectangleGeometry(toD2dRectF(entry.rect), &rect);
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create clip rectangle: %#lx", __FUNCTION__, hr);
+			return nullptr;
+		}
+		return rect;
+	}
+	case clipEntry::Region: {
+		// region rectangles never overlap, one closed figure each
+		ComPtr<ID2D1PathGeometry> geometry;
+		ComPtr<ID2D1GeometrySink> sink;
+		hr = factory()->CreatePathGeometry(geometry.GetAddressOf());
+		if (SUCCEEDED(hr))
+			hr = geometry->Open(&sink);
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create clip region geometry: %#lx", __FUNCTION__, hr);
+			return nullptr;
+		}
+		for (const QRect& r : entry.region) {
+			const FLOAT left = FLOAT(r.x());
+			const FLOAT top = FLOAT(r.y());
+			const FLOAT right = FLOAT(r.x() + r.width());
+			const FLOAT bottom = FLOAT(r.y() + r.height());
+			sink->BeginFigure(D2D1::Point2F(left, top), D2D1_FIGURE_BEGIN_FILLED);
+			sink->AddLine(D2D1::Point2F(right, top));
+			sink->AddLine(D2D1::Point2F(right, bottom));
+			sink->AddLine(D2D1::Point2F(left, bottom));
+			sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+		}
+		if (FAILED(sink->Close()))
+			return nullptr;
+		counters(m_stats).geometryCreated();
+		return geometry;
+	}
+	case clipEntry::Path:
+		if (const std::shared_ptr<Direct2DGeometryEntry> cached = cachedGeometry(entry.path))
+			return cached->geometry;
+		return nullptr;
+	}
+	return nullptr;
 }
 void Direct2DPaintEngine::drawPixmap(const QRectF& r, const QPixmap& pm, const QRectF& sr)
 {
-	drawImage(r, pm.toImage(), sr);
+	flushClip();
+	if (pm.isNull())
+		return;
+
+	ComPtr<ID2D1Bitmap> bitmap = cachedBitmap(pm);
+	if (!bitmap)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Pixmaps);
+
+	const D2D1_RECT_F dest = toD2dRectF(r);
+	const D2D1_RECT_F src = toD2dRectF(sr);
+	d->dc()->DrawBitmap(bitmap.Get(), &dest, FLOAT(state->opacity()), interpolationMode(), &src);
 }
 
-void Direct2DPaintEngine::drawPoints(const QPointF* points, int pointCount)
+// Points are squares (or circles for round caps) of the pen width filled with the pen brush.
+template<class Point>
+void Direct2DPaintEngine::drawPenPoints(const Point* points, int pointCount)
+{
+	if (!m_pen.brush || pointCount <= 0)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Points, pointCount);
+
+	const FLOAT width = FLOAT(qMax(qreal(1.0), m_pen.qpen.widthF()));
+	const bool round = m_pen.qpen.capStyle() == Qt::RoundCap && width > 1.0f;
+
+#ifndef __MINGW64__
+	// sprites are not scaled with the pen, only take them when the transform is a translation
+	if (m_pointBatchThreshold > 0 && pointCount >= m_pointBatchThreshold
+		&& m_pen.qpen.brush().style() == Qt::SolidPattern
+		&& state->transform().type() <= QTransform::TxTranslate
+		&& drawPointSprites(points, pointCount, qCeil(width), round))
+		return;
+#endif
+
+	const FLOAT half = width / 2;
+	for (int i = 0; i < pointCount; i++) {
+		const D2D1_POINT_2F c = adjusted(points[i]);
+		if (round)
+			d->dc()->FillEllipse(D2D1::Ellipse(c, half, half), m_pen.brush.Get());
+		else
+			d->dc()->FillRectangle(D2D1::RectF(c.x - half, c.y - half, c.x + half, c.y + half),
+				m_pen.brush.Get());
+	}
+}
+
+#ifndef __MINGW64__
+template<class Point>
+bool Direct2DPaintEngine::drawPointSprites(const Point* points, int pointCount, int size, bool round)
+{
+	Direct2DMarkerKey key;
+	key.shape = round ? Direct2DMarkerKey::Ellipse : Direct2DMarkerKey::Square;
+	key.width = size;
+	key.height = size;
+	ID2D1Bitmap1* marker = markerBitmap(key);
+	if (!marker)
+		return false;
+
+	const FLOAT half = FLOAT(size) / 2;
+	m_spriteRects.resize(size_t(pointCount));
+	for (int i = 0; i < pointCount; i++) {
+		const D2D1_POINT_2F c = adjusted(points[i]);
+		m_spriteRects[i] = D2D1::RectF(c.x - half, c.y - half, c.x + half, c.y + half);
+	}
+	return drawSprites(marker, pointCount, m_pen.qpen.color());
+}
+
+bool Direct2DPaintEngine::drawShapeSprites(const QRectF* rects,
+	int rectCount,
+	Direct2DMarkerKey::Shape shape,
+	qreal xRadius,
+	qreal yRadius)
+{
+	// tinted markers can only stand in for solid fills and strokes that do not scale
+	if (m_shapeBatchThreshold <= 0 || rectCount < m_shapeBatchThreshold
+		|| state->transform().type() > QTransform::TxTranslate)
+		return false;
+	const bool fill = m_brush.brush && m_brush.qbrush != Qt::NoBrush;
+	const bool stroke = m_pen.brush && m_pen.strokeStyle;
+	// all fills before all outlines would put outlines over later shapes, like drawRectBatch
+	// only fill-only and stroke-only batches are reordered
+	if (fill && stroke)
+		return false;
+	if ((fill && m_brush.qbrush.style() != Qt::SolidPattern)
+		|| (stroke
+			&& (m_pen.qpen.brush().style() != Qt::SolidPattern
+				|| m_pen.qpen.style() != Qt::SolidLine)))
+		return false;
+
+	const QSizeF size = rects[0].size();
+	for (int i = 1; i < rectCount; i++) {
+		if (rects[i].size() != size)
+			return false;
+	}
+
+	if (!ensureSpriteBatch())
+		return false;
+
+	Direct2DMarkerKey key;
+	key.shape = shape;
+	key.radiusX = float(xRadius);
+	key.radiusY = float(yRadius);
+	ID2D1Bitmap1* fillMarker = nullptr;
+	if (fill) {
+		key.width = qMax(1, qCeil(size.width()));
+		key.height = qMax(1, qCeil(size.height()));
+		if (!(fillMarker = markerBitmap(key)))
+			return false;
+	}
+	// the outline straddles the shape edge, its marker is larger by the pen width
+	const qreal penWidth = qMax(qreal(1.0), m_pen.qpen.widthF());
+	ID2D1Bitmap1* strokeMarker = nullptr;
+	if (stroke) {
+		key.width = qMax(1, qCeil(size.width() + penWidth));
+		key.height = qMax(1, qCeil(size.height() + penWidth));
+		key.stroke = float(penWidth);
+		if (!(strokeMarker = markerBitmap(key)))
+			return false;
+	}
+
+	m_spriteRects.resize(size_t(rectCount));
+	if (fillMarker) {
+		for (int i = 0; i < rectCount; i++)
+			m_spriteRects[i] = toD2dRectF(rects[i]);
+		if (!drawSprites(fillMarker, rectCount, m_brush.qbrush.color()))
+			return false;
+	}
+	if (strokeMarker) {
+		const qreal half = penWidth / 2;
+		for (int i = 0; i < rectCount; i++)
+			m_spriteRects[i] = toD2dRectF(rects[i].adjusted(-half, -half, half, half));
+		if (!drawSprites(strokeMarker, rectCount, m_pen.qpen.color()))
+			return false;
+	}
+	return true;
+}
+
+bool Direct2DPaintEngine::drawSprites(ID2D1Bitmap* marker, int count, const QColor& color)
+{
+	if (!ensureSpriteBatch())
+		return false;
+
+	QColor tintColor = color;
+	tintColor.setAlphaF(tintColor.alphaF() * state->opacity());
+	const D2D1_COLOR_F tint = toD2DColorF(tintColor);
+
+	// a zero stride repeats the single tint for every sprite
+	m_spriteBatch->Clear();
+	HRESULT hr = m_spriteBatch->AddSprites(UINT32(count),
+		m_spriteRects.data(),
+		nullptr,
+		&tint,
+		nullptr,
+		sizeof(D2D1_RECT_F),
+		0,
+		0,
+		0);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not add sprites: %#lx", __FUNCTION__, hr);
+		return false;
+	}
+
+	drawSpriteBatch(marker);
+	return true;
+}
+
+bool Direct2DPaintEngine::drawSprites(ID2D1Bitmap* marker, int count)
+{
+	if (!ensureSpriteBatch())
+		return false;
+
+	m_spriteBatch->Clear();
+	HRESULT hr = m_spriteBatch->AddSprites(UINT32(count),
+		m_spriteRects.data(),
+		nullptr,
+		m_spriteColors.data(),
+		nullptr,
+		sizeof(D2D1_RECT_F),
+		0,
+		sizeof(D2D1_COLOR_F),
+		0);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not add sprites: %#lx", __FUNCTION__, hr);
+		return false;
+	}
+
+	drawSpriteBatch(marker);
+	return true;
+}
+
+ID2D1Bitmap1* Direct2DPaintEngine::markerBitmap(const Direct2DMarkerKey& key)
 {
-	if (m_brush.brush) {
-		for (int i = 0; i < pointCount; i++) {
-			d->dc()->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(points[i].x(), points[i].y()),
-				1.0f,
-				1.0f),
-				m_brush.brush.Get(),
-				1.0f);
+	if (ComPtr<ID2D1Bitmap1>* cached = m_markers.find(key))
+		return cached->Get();
+
+	HRESULT hr;
+	if (!m_markerContext) {
+		hr = DirectContext::instance().d2dDevice()->CreateDeviceContext(
+			D2D1_DEVICE_CONTEXT_OPTIONS_NONE,
+			m_markerContext.ReleaseAndGetAddressOf());
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create marker device context: %#lx", __FUNCTION__, hr);
+			return nullptr;
 		}
+		m_markerContext->SetUnitMode(D2D1_UNIT_MODE_PIXELS);
+		m_markerContext->SetAntialiasMode(D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
+	}
+
+	ComPtr<ID2D1Bitmap1> bitmap;
+	hr = m_markerContext->CreateBitmap(D2D1::SizeU(UINT32(key.width), UINT32(key.height)),
+		nullptr,
+		0,
+		D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_TARGET,
+			D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+		&bitmap);
+	ComPtr<ID2D1SolidColorBrush> white;
+	if (SUCCEEDED(hr))
+		hr = m_markerContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White), &white);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create marker bitmap: %#lx", __FUNCTION__, hr);
+		return nullptr;
 	}
+
+	// outlines are drawn centered on a shape inset by half the stroke
+	const FLOAT inset = key.stroke / 2;
+	const D2D1_RECT_F bounds = D2D1::RectF(inset, inset, FLOAT(key.width) - inset, FLOAT(key.height) - inset);
+	const D2D1_ELLIPSE ellipse = D2D1::Ellipse(D2D1::Point2F(FLOAT(key.width) / 2, FLOAT(key.height) / 2),
+		(bounds.right - bounds.left) / 2,
+		(bounds.bottom - bounds.top) / 2);
+	const D2D1_ROUNDED_RECT rounded = D2D1::RoundedRect(bounds, key.radiusX, key.radiusY);
+	m_markerContext->SetTarget(bitmap.Get());
+	m_markerContext->BeginDraw();
+	m_markerContext->Clear(D2D1::ColorF(0, 0, 0, 0));
+	switch (key.shape) {
+	case Direct2DMarkerKey::Square:
+		if (key.stroke > 0)
+			m_markerContext->DrawRectangle(bounds, white.Get(), key.stroke);
+		else
+			m_markerContext->FillRectangle(bounds, white.Get());
+		break;
+	case Direct2DMarkerKey::Ellipse:
+		if (key.stroke > 0)
+			m_markerContext->DrawEllipse(ellipse, white.Get(), key.stroke);
+		else
+			m_markerContext->FillEllipse(ellipse, white.Get());
+		break;
+	case Direct2DMarkerKey::RoundedRect:
+		if (key.stroke > 0)
+			m_markerContext->DrawRoundedRectangle(rounded, white.Get(), key.stroke);
+		else
+			m_markerContext->FillRoundedRectangle(rounded, white.Get());
+		break;
+	}
+	hr = m_markerContext->EndDraw();
+	m_markerContext->SetTarget(nullptr);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not rasterize marker: %#lx", __FUNCTION__, hr);
+		return nullptr;
+	}
+
+	ComPtr<ID2D1Bitmap1>* inserted = m_markers.insert(key, bitmap);
+	return inserted ? inserted->Get() : nullptr;
+}
+
+bool Direct2DPaintEngine::ensureSpriteBatch()
+{
+	if (m_spriteBatch)
+		return true;
+
+	HRESULT hr = d->dc()->CreateSpriteBatch(&m_spriteBatch);
+	if (FAILED(hr))
+		qWarning("%s: Could not create sprite batch: %#lx", __FUNCTION__, hr);
+	return SUCCEEDED(hr);
+}
+
+void Direct2DPaintEngine::drawSpriteBatch(ID2D1Bitmap* bitmap)
+{
+	// sprite batches can only be drawn aliased
+	const D2D1_ANTIALIAS_MODE mode = d->dc()->GetAntialiasMode();
+	d->dc()->SetAntialiasMode(D2D1_ANTIALIAS_MODE_ALIASED);
+	d->dc()->DrawSpriteBatch(m_spriteBatch.Get(),
+		bitmap,
+		D2D1_BITMAP_INTERPOLATION_MODE_LINEAR,
+		D2D1_SPRITE_OPTIONS_NONE);
+	d->dc()->SetAntialiasMode(mode);
+}
+#endif
+
+void Direct2DPaintEngine::drawPoints(const QPointF* points, int pointCount)
+{
+	flushClip();
+	drawPenPoints(points, pointCount);
 }
 
 void Direct2DPaintEngine::drawPoints(const QPoint* points, int pointCount)
 {
-	if (m_pen.brush) {
-		for (int i = 0; i < pointCount; i++) {
-			d->dc()->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(points[i].x(), points[i].y()),
-				1.0f,
-				1.0f),
+	flushClip();
+	drawPenPoints(points, pointCount);
+}
+
+// QRectF rects are snapped to pixel centers like lines, QRect ones are drawn as given
+static inline D2D1_RECT_F toDrawnRect(const QRectF& rect)
+{
+	return toD2dRectF(rect.adjusted(PIXEL_SNAP, PIXEL_SNAP, PIXEL_SNAP, PIXEL_SNAP));
+}
+
+static inline D2D1_RECT_F toDrawnRect(const QRect& rect)
+{
+	return toD2dRectF(rect);
+}
+
+// Axis aligned rectangle given as four corners, in either winding.
+template<class Point>
+static bool polygonIsRect(const Point* points, QRectF* rect)
+{
+	const bool horizontalFirst = points[0].y() == points[1].y() && points[1].x() == points[2].x()
+		&& points[2].y() == points[3].y() && points[3].x() == points[0].x();
+	const bool verticalFirst = points[0].x() == points[1].x() && points[1].y() == points[2].y()
+		&& points[2].x() == points[3].x() && points[3].y() == points[0].y();
+	if (!horizontalFirst && !verticalFirst)
+		return false;
+	*rect = QRectF(QPointF(points[0]), QPointF(points[2])).normalized();
+	return true;
+}
+
+template<class Point>
+void Direct2DPaintEngine::drawPolygonPoints(const Point* points,
+	int pointCount,
+	QPaintEngine::PolygonDrawMode mode)
+{
+	if (pointCount < 2)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Polygons);
+
+	const bool closed = mode != PolylineMode;
+	// convex outlines fill the same under either rule, they share the odd-even geometry
+	const Qt::FillRule rule = mode == WindingMode ? Qt::WindingFill : Qt::OddEvenFill;
+
+	QRectF rect;
+	if (mode == ConvexMode && pointCount == 4 && polygonIsRect(points, &rect)) {
+		// snapped like the same rect would be by drawRects
+		D2D1_RECT_F d2dRect;
+		if constexpr (std::is_same_v<Point, QPoint>)
+			d2dRect = toDrawnRect(rect.toRect());
+		else
+			d2dRect = toDrawnRect(rect);
+		if (m_brush.brush && m_brush.qbrush != Qt::NoBrush)
+			d->dc()->FillRectangle(d2dRect, m_brush.brush.Get());
+		if (m_pen.brush && m_pen.strokeStyle)
+			d->dc()->DrawRectangle(d2dRect,
 				m_pen.brush.Get(),
-				1.0f);
-		}
+				FLOAT(m_pen.qpen.widthF()),
+				m_pen.strokeStyle.Get());
+		return;
 	}
+
+	// Small polygons are mostly one-off shapes (markers, glyph-like symbols, mesh cells), many
+	// thousands of them would only cycle through the shared cache. They are built into the
+	// scratch entry instead, skipping the hash, the cache node and realizations.
+	if (pointCount < m_polygonCacheThreshold) {
+		if (!buildPolygonGeometry(points,
+				pointCount,
+				rule,
+				closed,
+				m_scratchPolygon.geometry.ReleaseAndGetAddressOf()))
+			return;
+		drawGeometry(m_scratchPolygon, closed, false);
+		return;
+	}
+
+	if (const std::shared_ptr<Direct2DGeometryEntry> entry
+		= cachedGeometry(points, pointCount, rule, closed))
+		drawGeometry(*entry, closed);
 }
 
 void Direct2DPaintEngine::drawPolygon(const QPointF* points,
 	int pointCount,
 	QPaintEngine::PolygonDrawMode mode)
 {
-	UNUSED(points);
-	UNUSED(pointCount);
-	UNUSED(mode);
+	flushClip();
+	drawPolygonPoints(points, pointCount, mode);
 }
 
 void Direct2DPaintEngine::drawPolygon(const QPoint* points,
 	int pointCount,
 	QPaintEngine::PolygonDrawMode mode)
 {
-	UNUSED(points);
-	UNUSED(pointCount);
-	UNUSED(mode);
+	flushClip();
+	drawPolygonPoints(points, pointCount, mode);
 }
 
-void Direct2DPaintEngine::drawRects(const QRectF* rects, int rectCount)
+template<class Rect>
+void Direct2DPaintEngine::drawRectBatch(const Rect* rects, int rectCount)
 {
+	if (rectCount <= 0)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Rects, rectCount);
+
+	ID2D1Brush* fill = state->brush() != Qt::NoBrush && m_brush.brush ? m_brush.brush.Get() : nullptr;
+	ID2D1Brush* stroke = state->pen() != Qt::NoPen && m_pen.brush && m_pen.strokeStyle
+		? m_pen.brush.Get()
+		: nullptr;
+	ID2D1DEVICECONTEXT* dc = d->dc();
+
+#ifndef __MINGW64__
+	// fills and outlines interleave per rect, so only unstroked batches can be reordered
+	if (fill && !stroke && m_brush.qbrush.style() == Qt::SolidPattern
+		&& rectSpritesAllowed(rectCount)) {
+		if (ID2D1Bitmap1* marker = pixelMarker()) {
+			m_spriteRects.resize(size_t(rectCount));
+			for (int i = 0; i < rectCount; ++i)
+				m_spriteRects[i] = toDrawnRect(rects[i]);
+			if (drawSprites(marker, rectCount, m_brush.qbrush.color()))
+				return;
+		}
+	}
+#endif
+
+	if (!stroke) {
+		if (!fill)
+			return;
+		for (int i = 0; i < rectCount; ++i)
+			dc->FillRectangle(toDrawnRect(rects[i]), fill);
+		return;
+	}
+
+	const FLOAT penWidth = FLOAT(m_pen.qpen.widthF());
+	ID2D1StrokeStyle1* strokeStyle = m_pen.strokeStyle.Get();
+	if (!fill) {
+		for (int i = 0; i < rectCount; ++i)
+			dc->DrawRectangle(toDrawnRect(rects[i]), stroke, penWidth, strokeStyle);
+		return;
+	}
 	for (int i = 0; i < rectCount; ++i) {
-		D2D1_RECT_F rect = toD2dRectF(
-			rects[i].adjusted(PIXEL_SNAP, PIXEL_SNAP, PIXEL_SNAP, PIXEL_SNAP));
-		if (state->brush() != Qt::NoBrush && m_brush.brush)
-			d->dc()->FillRectangle(rect, m_brush.brush.Get());
-		if (state->pen() != Qt::NoPen && m_pen.brush && m_pen.strokeStyle)
-			d->dc()->DrawRectangle(rect,
-				m_pen.brush.Get(),
-				(FLOAT)m_pen.qpen.widthF(),
-				m_pen.strokeStyle.Get());
+		const D2D1_RECT_F rect = toDrawnRect(rects[i]);
+		dc->FillRectangle(rect, fill);
+		dc->DrawRectangle(rect, stroke, penWidth, strokeStyle);
 	}
 }
 
+void Direct2DPaintEngine::drawRects(const QRectF* rects, int rectCount)
+{
+	flushClip();
+	drawRectBatch(rects, rectCount);
+}
+
 void Direct2DPaintEngine::drawRects(const QRect* rects, int rectCount)
 {
+	flushClip();
+	drawRectBatch(rects, rectCount);
+}
+
+void Direct2DPaintEngine::fillRects(const QRectF* rects, const QColor* colors, int rectCount)
+{
+	flushClip();
+	if (rectCount <= 0)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Rects, rectCount);
+
+	const qreal opacity = state->opacity();
+#ifndef __MINGW64__
+	if (rectSpritesAllowed(rectCount)) {
+		if (ID2D1Bitmap1* marker = pixelMarker()) {
+			m_spriteRects.resize(size_t(rectCount));
+			m_spriteColors.resize(size_t(rectCount));
+			for (int i = 0; i < rectCount; ++i) {
+				m_spriteRects[i] = toDrawnRect(rects[i]);
+				m_spriteColors[i] = D2D1::ColorF(FLOAT(colors[i].redF()),
+					FLOAT(colors[i].greenF()),
+					FLOAT(colors[i].blueF()),
+					FLOAT(colors[i].alphaF() * opacity));
+			}
+			if (drawSprites(marker, rectCount))
+				return;
+		}
+	}
+#endif
+
+	if (!m_fillRectsBrush) {
+		HRESULT hr = d->dc()->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White),
+			m_fillRectsBrush.ReleaseAndGetAddressOf());
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create brush: %#lx", __FUNCTION__, hr);
+			return;
+		}
+		counters(m_stats).brushCreated();
+	}
+	m_fillRectsBrush->SetOpacity(FLOAT(opacity));
+	ID2D1DEVICECONTEXT* dc = d->dc();
 	for (int i = 0; i < rectCount; ++i) {
-		D2D1_RECT_F rect = toD2dRectF(rects[i]);
-		if (state->brush() != Qt::NoBrush && m_brush.brush)
-			d->dc()->FillRectangle(rect, m_brush.brush.Get());
-		if (state->pen() != Qt::NoPen && m_pen.brush && m_pen.strokeStyle)
-			d->dc()->DrawRectangle(rect,
-				m_pen.brush.Get(),
-				(FLOAT)m_pen.qpen.widthF(),
-				m_pen.strokeStyle.Get());
+		m_fillRectsBrush->SetColor(toD2DColorF(colors[i]));
+		dc->FillRectangle(toDrawnRect(rects[i]), m_fillRectsBrush.Get());
+	}
+}
+
+bool Direct2DPaintEngine::fillRects(QPainter& painter,
+	const QRectF* rects,
+	const QColor* colors,
+	int rectCount)
+{
+	Direct2DPaintEngine* engine = fromPainter(painter);
+	if (!engine)
+		return false;
+	engine->fillRects(rects, colors, rectCount);
+	return true;
+}
+
+std::shared_ptr<const Direct2DGlyphRun> Direct2DPaintEngine::cachedGlyphRun(const QFont& font,
+	const QString& text,
+	int flags)
+{
+	const Direct2DGlyphRunKey key(font, text, flags);
+	Direct2DGlyphRunCache& cache = DirectContext::instance().glyphRunCache();
+	if (std::optional<std::shared_ptr<const Direct2DGlyphRun>> cached = cache.find(key))
+		return *cached;
+
+	const QRawFont raw = QRawFont::fromFont(key.font);
+	const QList<quint32> indexes = raw.glyphIndexesForString(text);
+	const QList<QPointF> adv = raw.advancesForGlyphIndexes(indexes);
+	if (adv.size() != indexes.size())
+		return nullptr;
+
+	auto run = std::make_shared<Direct2DGlyphRun>();
+	run->emSize = FLOAT(raw.pixelSize());
+	run->indices.resize(size_t(indexes.size()));
+	run->advances.resize(size_t(indexes.size()));
+	// QRawFont does not position glyphs beyond their advances, offsets stay zero
+	run->offsets.resize(size_t(indexes.size()), DWRITE_GLYPH_OFFSET{ 0, 0 });
+	for (qsizetype i = 0; i < indexes.size(); i++) {
+		run->indices[i] = UINT16(indexes[i]);
+		run->advances[i] = FLOAT(adv[i].x());
 	}
+
+	// runs over the budget are not kept, the caller's reference is the only one
+	const size_t cost = run->cost() + size_t(text.size()) * sizeof(QChar);
+	std::shared_ptr<const Direct2DGlyphRun> result = std::move(run);
+	cache.insert(key, result, cost);
+	return result;
 }
 
 void Direct2DPaintEngine::drawTextItem(const QPointF& p, const QTextItem& textItem)
 {
-	ComPtr<IDWriteFontFace> fontFace = getFont();
-	if (fontFace) {
-		const QString text = textItem.text();
-		QRawFont raw = QRawFont::fromFont(state->font());
-		QList<quint32> indexes = raw.glyphIndexesForString(text);
-		QList<QPointF> adv = raw.advancesForGlyphIndexes(indexes);
-		QVarLengthArray<UINT16> glyphIndices(indexes.size());
-		QVarLengthArray<FLOAT> glyphAdvances(indexes.size());
-		QVarLengthArray<DWRITE_GLYPH_OFFSET> glyphOffsets(indexes.size());
-		if (adv.size() == glyphIndices.size()) {
-			for (long long i = 0; i < glyphIndices.size(); i++) {
-				glyphIndices[i] = UINT16(indexes[i]);
-				glyphAdvances[i] = FLOAT(adv[i].x());
-				// nao sei oq eh isso, oq isso faz, se um dia alguem mais instruido ver isso e souber fazer corretamente por favor
-				glyphOffsets[i].advanceOffset = 0;
-				glyphOffsets[i].ascenderOffset = 0;
+	flushClip();
+	ComPtr<IDWriteFontFace> fontFace = getFont(state->font());
+	if (!fontFace)
+		return;
+
+	const QString text = textItem.text();
+	const std::shared_ptr<const Direct2DGlyphRun> run
+		= cachedGlyphRun(state->font(), text, int(textItem.renderFlags()));
+	if (!run || run->indices.empty())
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Text, text.size());
+
+	DWRITE_GLYPH_RUN glyphRun;
+	glyphRun.fontFace = fontFace.Get();
+	glyphRun.fontEmSize = run->emSize;
+	glyphRun.glyphCount = UINT32(run->indices.size());
+	glyphRun.glyphIndices = run->indices.data();
+	glyphRun.glyphAdvances = run->advances.data();
+	glyphRun.glyphOffsets = run->offsets.data();
+	glyphRun.isSideways = FALSE;
+	glyphRun.bidiLevel = 0;
+	d->dc()->DrawGlyphRun(tod2dPoint2f(p),
+		&glyphRun,
+		m_pen.brush.Get(),
+		DWRITE_MEASURING_MODE_NATURAL);
+}
+
+void Direct2DPaintEngine::drawTextRuns(const Direct2DTextLabel* labels, int labelCount)
+{
+	flushClip();
+	if (labelCount <= 0)
+		return;
+
+	// number the distinct (font, color) pairs, charts rarely use more than a handful
+	if (m_labelGroupIds.size() > kMaxLabelGroups) {
+		m_labelGroupIds.clear();
+		m_labelGroupFonts.clear();
+	}
+	m_labelGroups.resize(size_t(labelCount));
+	for (int i = 0; i < labelCount; i++) {
+		// consecutive labels mostly share their group
+		if (i > 0 && labels[i].font == labels[i - 1].font
+			&& labels[i].color.rgba() == labels[i - 1].color.rgba()) {
+			m_labelGroups[i] = m_labelGroups[i - 1];
+			continue;
+		}
+		const QPair<QFont, QRgb> group(labels[i].font, labels[i].color.rgba());
+		auto it = m_labelGroupIds.constFind(group);
+		if (it == m_labelGroupIds.constEnd()) {
+			it = m_labelGroupIds.insert(group, int(m_labelGroupFonts.size()));
+			m_labelGroupFonts.push_back(labels[i].font);
+		}
+		m_labelGroups[i] = it.value();
+	}
+
+	m_labelOrder.resize(size_t(labelCount));
+	for (int i = 0; i < labelCount; i++)
+		m_labelOrder[i] = i;
+	std::stable_sort(m_labelOrder.begin(), m_labelOrder.end(), [this](int a, int b) {
+		return m_labelGroups[a] < m_labelGroups[b];
+	});
+
+	for (size_t first = 0; first < m_labelOrder.size();) {
+		const int group = m_labelGroups[m_labelOrder[first]];
+		size_t last = first;
+		while (last < m_labelOrder.size() && m_labelGroups[m_labelOrder[last]] == group)
+			++last;
+
+		const QFont& font = m_labelGroupFonts[size_t(group)];
+		ComPtr<IDWriteFontFace> fontFace = getFont(font);
+		ComPtr<ID2D1Brush> brush = cachedBrush(QBrush(labels[m_labelOrder[first]].color), QPointF());
+		if (!fontFace || !brush) {
+			first = last;
+			continue;
+		}
+
+		// every glyph is placed by its offset from the first label's origin, advances are zero
+		const QPointF origin = labels[m_labelOrder[first]].position;
+		FLOAT emSize = 0.0f;
+		m_runIndices.clear();
+		m_runAdvances.clear();
+		m_runOffsets.clear();
+		for (size_t i = first; i < last; i++) {
+			const Direct2DTextLabel& label = labels[m_labelOrder[i]];
+			const std::shared_ptr<const Direct2DGlyphRun> run = cachedGlyphRun(font, label.text, 0);
+			if (!run)
+				continue;
+			counters(m_stats).draw(Direct2DFrameStats::Text, label.text.size());
+
+			emSize = run->emSize;
+			FLOAT x = FLOAT(label.position.x() - origin.x());
+			const FLOAT y = FLOAT(label.position.y() - origin.y());
+			for (size_t g = 0; g < run->indices.size(); g++) {
+				m_runIndices.push_back(run->indices[g]);
+				m_runAdvances.push_back(0.0f);
+				// ascender offsets point up, device y points down
+				m_runOffsets.push_back(
+					{ x + run->offsets[g].advanceOffset, run->offsets[g].ascenderOffset - y });
+				x += run->advances[g];
 			}
+		}
+
+		if (!m_runIndices.empty()) {
 			DWRITE_GLYPH_RUN glyphRun;
 			glyphRun.fontFace = fontFace.Get();
-			glyphRun.fontEmSize = raw.pixelSize();
-			glyphRun.glyphCount = indexes.size();
-			glyphRun.glyphIndices = glyphIndices.constData();
-			glyphRun.glyphAdvances = glyphAdvances.constData();
-			glyphRun.glyphOffsets = nullptr;
+			glyphRun.fontEmSize = emSize;
+			glyphRun.glyphCount = UINT32(m_runIndices.size());
+			glyphRun.glyphIndices = m_runIndices.data();
+			glyphRun.glyphAdvances = m_runAdvances.data();
+			glyphRun.glyphOffsets = m_runOffsets.data();
 			glyphRun.isSideways = FALSE;
 			glyphRun.bidiLevel = 0;
-			d->dc()->DrawGlyphRun(tod2dPoint2f(p),
+			d->dc()->DrawGlyphRun(tod2dPoint2f(origin),
 				&glyphRun,
-				m_pen.brush.Get(),
+				brush.Get(),
 				DWRITE_MEASURING_MODE_NATURAL);
 		}
+		first = last;
 	}
 }
 
+Direct2DPaintEngine* Direct2DPaintEngine::fromPainter(QPainter& painter)
+{
+	QPaintEngine* engine = painter.paintEngine();
+	if (!engine || engine->type() != QPaintEngine::User)
+		return nullptr;
+
+	auto* direct2dEngine = dynamic_cast<Direct2DPaintEngine*>(engine);
+	// QPainter hands state over lazily before its own draw calls
+	if (direct2dEngine)
+		direct2dEngine->syncState();
+	return direct2dEngine;
+}
+
+bool Direct2DPaintEngine::drawTextRuns(QPainter& painter,
+	const Direct2DTextLabel* labels,
+	int labelCount)
+{
+	Direct2DPaintEngine* engine = fromPainter(painter);
+	if (!engine)
+		return false;
+	engine->drawTextRuns(labels, labelCount);
+	return true;
+}
+
+void Direct2DPaintEngine::drawImageStream(const QRectF& target, const Direct2DImageStream& stream)
+{
+	flushClip();
+	ID2D1Bitmap1* bitmap = stream.latest();
+	if (!bitmap)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Images);
+
+	const D2D1_RECT_F dest = toD2dRectF(target);
+	d->dc()->DrawBitmap(bitmap, &dest, FLOAT(state->opacity()), interpolationMode(), nullptr);
+}
+
+bool Direct2DPaintEngine::drawImageStream(QPainter& painter,
+	const QRectF& target,
+	const Direct2DImageStream& stream)
+{
+	Direct2DPaintEngine* engine = fromPainter(painter);
+	if (!engine)
+		return false;
+	engine->drawImageStream(target, stream);
+	return true;
+}
+
 void Direct2DPaintEngine::drawTiledPixmap(const QRectF& rect,
 	const QPixmap& pixmap,
 	const QPointF& p)
 {
+	flushClip();
 	if (pixmap.isNull())
 		return;
 
-	// Convert QPixmap to ID2D1Bitmap
-	ComPtr<ID2D1Bitmap> d2dBitmap = QPixmapToD2D1Bitmap(pixmap);
-	if (!d2dBitmap)
+	// a wrapping bitmap brush tiles in a single fill, whatever the number of tiles
+	ComPtr<ID2D1Brush> brush = cachedBrush(QBrush(pixmap), QPointF());
+	if (!brush)
 		return;
-
-	D2D1_SIZE_F size = d2dBitmap->GetSize();
-	D2D1_RECT_F sourceRect = D2D1::RectF(0, 0, size.width, size.height);
-	D2D1_RECT_F destRect;
-
-	// Calculate the starting point
-	float startX = rect.left() + p.x();
-	float startY = rect.top() + p.y();
-
-	// Tile the pixmap across the specified rect
-	for (float y = startY; y < rect.bottom(); y += size.height) {
-		for (float x = startX; x < rect.right(); x += size.width) {
-			destRect = D2D1::RectF(x, y, x + size.width, y + size.height);
-
-			// Adjust the destination rect if it goes outside of the specified rect
-			if (destRect.right > rect.right()) {
-				destRect.right = rect.right();
-			}
-			if (destRect.bottom > rect.bottom()) {
-				destRect.bottom = rect.bottom();
-			}
-
-			// Draw the bitmap
-			d->dc()->DrawBitmap(d2dBitmap.Get(),
-				destRect,
-				1.0f,
-				D2D1_BITMAP_INTERPOLATION_MODE_LINEAR,
-				&sourceRect);
-		}
-	}
+	counters(m_stats).draw(Direct2DFrameStats::TiledPixmaps);
+
+	// the first tile starts at rect.topLeft() - p, shift the world so the cached brush
+	// can be used untouched
+	const QPointF origin = rect.topLeft() - p;
+	D2D1_MATRIX_3X2_F transform;
+	d->dc()->GetTransform(&transform);
+	d->dc()->SetTransform(D2D1::Matrix3x2F::Translation(FLOAT(origin.x()), FLOAT(origin.y()))
+		* *(D2D1::Matrix3x2F::ReinterpretBaseType(&transform)));
+	d->dc()->FillRectangle(toD2dRectF(rect.translated(-origin)), brush.Get());
+	d->dc()->SetTransform(transform);
 }
 
 void Direct2DPaintEngine::drawD2DBitmap(ID2D1Bitmap* bitmap,
@@ -670,37 +1604,237 @@ void Direct2DPaintEngine::drawD2DBitmap(ID2D1Bitmap* bitmap,
 	D2D1_BITMAP_INTERPOLATION_MODE interpolationMode,
 	const D2D1_RECT_F* src)
 {
+	flushClip();
 	d->dc()->DrawBitmap(bitmap, dest, opacity, interpolationMode, src);
 }
 
 void Direct2DPaintEngine::drawLinePath(const QPointF* path, const size_t count)
 {
-	ComPtr<ID2D1PathGeometry> d2dPath;
-	if (SUCCEEDED(factory()->CreatePathGeometry(d2dPath.GetAddressOf()))) {
-		ID2D1GeometrySink* pSink = NULL;
-		if (SUCCEEDED(d2dPath->Open(&pSink))) {
-			if (count) {
-				pSink->BeginFigure(D2D1::Point2F(path[0].x(), path[0].y()),
-					D2D1_FIGURE_BEGIN_FILLED);
-				for (size_t i = 1; i < count; i++) {
-					pSink->AddLine(D2D1::Point2F(path[i].x(), path[i].y()));
-				}
-				pSink->EndFigure(D2D1_FIGURE_END_CLOSED);
-				std::ignore = pSink->Close();
-
-				if (m_brush.brush && m_brush.qbrush != Qt::NoBrush) {
-					d->dc()->FillGeometry(d2dPath.Get(), m_brush.brush.Get());
-				}
-				if (m_pen.brush && m_pen.strokeStyle) {
-					d->dc()->DrawGeometry(d2dPath.Get(),
-						m_pen.brush.Get(),
-						m_pen.qpen.widthF(),
-						m_pen.strokeStyle.Get());
-				}
-				SafeRelease(&pSink);
+	flushClip();
+	if (!count)
+		return;
+
+	counters(m_stats).draw(Direct2DFrameStats::Paths, qint64(count));
+	if (const std::shared_ptr<Direct2DGeometryEntry> entry
+		= cachedGeometry(path, int(count), Qt::OddEvenFill, true))
+		drawGeometry(*entry);
+}
+
+static void addPathToSink(ID2D1GeometrySink* sink, const QPainterPath& path)
+{
+	sink->SetFillMode(path.fillRule() == Qt::WindingFill ? D2D1_FILL_MODE_WINDING
+		: D2D1_FILL_MODE_ALTERNATE);
+
+	bool figureOpen = false;
+	for (int i = 0; i < path.elementCount(); ++i) {
+		const QPainterPath::Element& element = path.elementAt(i);
+		switch (element.type) {
+		case QPainterPath::MoveToElement:
+			if (figureOpen) {
+				sink->EndFigure(D2D1_FIGURE_END_OPEN);
 			}
+			sink->BeginFigure(D2D1::Point2F(element.x, element.y),
+				D2D1_FIGURE_BEGIN_FILLED);
+			figureOpen = true;
+			break;
+		case QPainterPath::LineToElement:
+			sink->AddLine(D2D1::Point2F(element.x, element.y));
+			break;
+		case QPainterPath::CurveToElement: {
+			// the first control point is stored in the CurveToElement itself, followed by
+			// the second control point and the end point as CurveToDataElements
+			if (i + 2 < path.elementCount()) {
+				const QPainterPath::Element& controlPoint2 = path.elementAt(++i);
+				const QPainterPath::Element& endPoint = path.elementAt(++i);
+				sink->AddBezier(
+					D2D1::BezierSegment(D2D1::Point2F(element.x, element.y),
+						D2D1::Point2F(controlPoint2.x, controlPoint2.y),
+						D2D1::Point2F(endPoint.x, endPoint.y)));
+			}
+		} break;
+		case QPainterPath::CurveToDataElement:
+			// This case is handled within CurveToElement
+			break;
 		}
 	}
+
+	if (figureOpen)
+		sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+}
+
+std::shared_ptr<Direct2DGeometryEntry> Direct2DPaintEngine::cachedGeometry(const QPainterPath& path)
+{
+	const Direct2DPathKey key(path);
+	if (std::optional<std::shared_ptr<Direct2DGeometryEntry>> cached
+		= DirectContext::instance().geometryCache().find(key))
+		return *cached;
+
+	std::shared_ptr<Direct2DGeometryEntry> entry = std::make_shared<Direct2DGeometryEntry>();
+	ComPtr<ID2D1GeometrySink> sink;
+	HRESULT hr = factory()->CreatePathGeometry(entry->geometry.GetAddressOf());
+	if (SUCCEEDED(hr))
+		hr = entry->geometry->Open(&sink);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create path geometry: %#lx", __FUNCTION__, hr);
+		return nullptr;
+	}
+
+	addPathToSink(sink.Get(), path);
+	if (FAILED(sink->Close()))
+		return nullptr;
+
+	counters(m_stats).geometryCreated();
+	return insertGeometry(key, std::move(entry));
+}
+
+template<class Point>
+std::shared_ptr<Direct2DGeometryEntry> Direct2DPaintEngine::cachedGeometry(const Point* points,
+	int count,
+	Qt::FillRule rule,
+	bool closed)
+{
+	const Direct2DPathKey key(points, count, rule, closed);
+	if (std::optional<std::shared_ptr<Direct2DGeometryEntry>> cached
+		= DirectContext::instance().geometryCache().find(key))
+		return *cached;
+
+	std::shared_ptr<Direct2DGeometryEntry> entry = std::make_shared<Direct2DGeometryEntry>();
+	if (!buildPolygonGeometry(points, count, rule, closed, entry->geometry.GetAddressOf()))
+		return nullptr;
+	return insertGeometry(key, std::move(entry));
+}
+
+template<class Point>
+bool Direct2DPaintEngine::buildPolygonGeometry(const Point* points,
+	int count,
+	Qt::FillRule rule,
+	bool closed,
+	ID2D1PathGeometry** geometry)
+{
+	ComPtr<ID2D1GeometrySink> sink;
+	HRESULT hr = factory()->CreatePathGeometry(geometry);
+	if (SUCCEEDED(hr))
+		hr = (*geometry)->Open(&sink);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create path geometry: %#lx", __FUNCTION__, hr);
+		return false;
+	}
+
+	sink->SetFillMode(rule == Qt::WindingFill ? D2D1_FILL_MODE_WINDING : D2D1_FILL_MODE_ALTERNATE);
+	sink->BeginFigure(tod2dPoint2f(points[0]),
+		closed ? D2D1_FIGURE_BEGIN_FILLED : D2D1_FIGURE_BEGIN_HOLLOW);
+	for (int i = 1; i < count; i++) {
+		sink->AddLine(tod2dPoint2f(points[i]));
+	}
+	sink->EndFigure(closed ? D2D1_FIGURE_END_CLOSED : D2D1_FIGURE_END_OPEN);
+	if (FAILED(sink->Close()))
+		return false;
+
+	counters(m_stats).geometryCreated();
+	return true;
+}
+
+std::shared_ptr<Direct2DGeometryEntry> Direct2DPaintEngine::insertGeometry(const Direct2DPathKey& key,
+	std::shared_ptr<Direct2DGeometryEntry> entry)
+{
+	// a geometry over the whole budget is not kept, the caller draws it once all the same
+	DirectContext::instance().geometryCache().insert(key.stored(), entry, key.cost());
+	return entry;
+}
+
+void Direct2DPaintEngine::drawGeometry(Direct2DGeometryEntry& entry, bool fillable, bool realizable)
+{
+	const bool fill = fillable && m_brush.brush && m_brush.qbrush != Qt::NoBrush;
+	const bool stroke = m_pen.brush && m_pen.strokeStyle;
+
+#ifndef __MINGW64__
+	if (realizable && m_realizationThreshold > 0) {
+		// drawn from copies, another thread may replace the realizations once the lock is gone
+		ComPtr<ID2D1GeometryRealization> fillRealization;
+		ComPtr<ID2D1GeometryRealization> strokeRealization;
+		bool realized;
+		{
+			std::lock_guard<std::mutex> lock(entry.mutex);
+			realized = realizeGeometry(entry, fill, stroke);
+			fillRealization = entry.fill;
+			strokeRealization = entry.stroke;
+		}
+		if (realized) {
+			if (fill)
+				d->dc()->DrawGeometryRealization(fillRealization.Get(), m_brush.brush.Get());
+			if (stroke)
+				d->dc()->DrawGeometryRealization(strokeRealization.Get(), m_pen.brush.Get());
+			return;
+		}
+	}
+#endif
+
+	if (fill) {
+		d->dc()->FillGeometry(entry.geometry.Get(), m_brush.brush.Get());
+	}
+	if (stroke) {
+		d->dc()->DrawGeometry(entry.geometry.Get(),
+			m_pen.brush.Get(),
+			m_pen.qpen.widthF(),
+			m_pen.strokeStyle.Get());
+	}
+}
+
+bool Direct2DPaintEngine::realizeGeometry(Direct2DGeometryEntry& entry, bool fill, bool stroke)
+{
+#ifdef __MINGW64__
+	UNUSED(entry);
+	UNUSED(fill);
+	UNUSED(stroke);
+	return false;
+#else
+	D2D1_MATRIX_3X2_F transform;
+	d->dc()->GetTransform(&transform);
+	const FLOAT scale = std::sqrt(std::abs(transform._11 * transform._22 - transform._12 * transform._21));
+
+	// realizations are tessellated for one scale, start counting again when it changes
+	if (std::abs(scale - entry.scale) > scale * 1e-3f) {
+		entry.scale = scale;
+		entry.sameScaleDraws = 0;
+		entry.fill.Reset();
+		entry.stroke.Reset();
+	}
+	if (++entry.sameScaleDraws < m_realizationThreshold)
+		return false;
+
+	FLOAT dpiX = 96.0f;
+	FLOAT dpiY = 96.0f;
+	d->dc()->GetDpi(&dpiX, &dpiY);
+	const FLOAT tolerance = D2D1::ComputeFlatteningTolerance(
+		*D2D1::Matrix3x2F::ReinterpretBaseType(&transform), dpiX, dpiY);
+
+	HRESULT hr;
+	if (fill && !entry.fill) {
+		hr = d->dc()->CreateFilledGeometryRealization(entry.geometry.Get(), tolerance, &entry.fill);
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create filled geometry realization: %#lx", __FUNCTION__, hr);
+			return false;
+		}
+	}
+
+	const FLOAT strokeWidth = FLOAT(m_pen.qpen.widthF());
+	if (stroke
+		&& (!entry.stroke || entry.strokeStyle != m_pen.strokeStyle
+			|| entry.strokeWidth != strokeWidth)) {
+		hr = d->dc()->CreateStrokedGeometryRealization(entry.geometry.Get(),
+			tolerance,
+			strokeWidth,
+			m_pen.strokeStyle.Get(),
+			entry.stroke.ReleaseAndGetAddressOf());
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create stroked geometry realization: %#lx", __FUNCTION__, hr);
+			return false;
+		}
+		entry.strokeStyle = m_pen.strokeStyle;
+		entry.strokeWidth = strokeWidth;
+	}
+	return true;
+#endif
 }
 
 QPaintEngine::Type Direct2DPaintEngine::type() const
@@ -710,12 +1844,103 @@ QPaintEngine::Type Direct2DPaintEngine::type() const
 
 void Direct2DPaintEngine::drawEllipse(const QRectF& rect)
 {
-	UNUSED(rect);
+	flushClip();
+	drawShapes(&rect, 1, 0, 0, true);
 }
 
 void Direct2DPaintEngine::drawEllipse(const QRect& rect)
 {
-	UNUSED(rect);
+	flushClip();
+	const QRectF rectF(rect);
+	drawShapes(&rectF, 1, 0, 0, true);
+}
+
+void Direct2DPaintEngine::drawShapes(const QRectF* rects,
+	int rectCount,
+	qreal xRadius,
+	qreal yRadius,
+	bool ellipse)
+{
+	if (rectCount <= 0)
+		return;
+	counters(m_stats).draw(ellipse ? Direct2DFrameStats::Ellipses : Direct2DFrameStats::Rects, rectCount);
+
+#ifndef __MINGW64__
+	if (rectCount > 1
+		&& drawShapeSprites(rects,
+			rectCount,
+			ellipse ? Direct2DMarkerKey::Ellipse : Direct2DMarkerKey::RoundedRect,
+			xRadius,
+			yRadius))
+		return;
+#endif
+
+	ID2D1Brush* fill = m_brush.brush && m_brush.qbrush != Qt::NoBrush ? m_brush.brush.Get() : nullptr;
+	ID2D1Brush* stroke = m_pen.brush && m_pen.strokeStyle ? m_pen.brush.Get() : nullptr;
+	const FLOAT penWidth = FLOAT(m_pen.qpen.widthF());
+	ID2D1StrokeStyle1* strokeStyle = m_pen.strokeStyle.Get();
+	ID2D1DEVICECONTEXT* dc = d->dc();
+
+	if (ellipse) {
+		for (int i = 0; i < rectCount; i++) {
+			const QPointF center = rects[i].center();
+			const D2D1_ELLIPSE e = D2D1::Ellipse(tod2dPoint2f(center),
+				FLOAT(rects[i].width() / 2),
+				FLOAT(rects[i].height() / 2));
+			if (fill)
+				dc->FillEllipse(e, fill);
+			if (stroke)
+				dc->DrawEllipse(e, stroke, penWidth, strokeStyle);
+		}
+		return;
+	}
+
+	for (int i = 0; i < rectCount; i++) {
+		const D2D1_ROUNDED_RECT r = D2D1::RoundedRect(toD2dRectF(rects[i]),
+			FLOAT(xRadius),
+			FLOAT(yRadius));
+		if (fill)
+			dc->FillRoundedRectangle(r, fill);
+		if (stroke)
+			dc->DrawRoundedRectangle(r, stroke, penWidth, strokeStyle);
+	}
+}
+
+void Direct2DPaintEngine::drawEllipses(const QRectF* rects, int rectCount)
+{
+	flushClip();
+	drawShapes(rects, rectCount, 0, 0, true);
+}
+
+bool Direct2DPaintEngine::drawEllipses(QPainter& painter, const QRectF* rects, int rectCount)
+{
+	Direct2DPaintEngine* engine = fromPainter(painter);
+	if (!engine)
+		return false;
+	engine->drawEllipses(rects, rectCount);
+	return true;
+}
+
+void Direct2DPaintEngine::drawRoundedRects(const QRectF* rects,
+	int rectCount,
+	qreal xRadius,
+	qreal yRadius)
+{
+	flushClip();
+	drawShapes(rects, rectCount, xRadius, yRadius, false);
+}
+
+bool Direct2DPaintEngine::drawRoundedRects(QPainter& painter,
+	const QRectF* rects,
+	int rectCount,
+	qreal xRadius,
+	qreal yRadius)
+{
+	Direct2DPaintEngine* engine = fromPainter(painter);
+	if (!engine)
+		return false;
+	engine->drawRoundedRects(rects, rectCount, xRadius, yRadius);
+	return true;
 }
 
 void Direct2DPaintEngine::drawImage(const QRectF& rectangle,
@@ -723,125 +1948,101 @@ void Direct2DPaintEngine::drawImage(const QRectF& rectangle,
 	const QRectF& sr,
 	Qt::ImageConversionFlags flags)
 {
+	flushClip();
 	(void)flags;
-	QImage renderImage = image;
-	if (renderImage.format() != QImage::Format_ARGB32_Premultiplied)
-		renderImage = renderImage.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	if (image.isNull())
+		return;
 
-	FLOAT dpiY = 96.0;
-	FLOAT dpiX = 96.0;
-	d->dc()->GetDpi(&dpiX, &dpiY);
-	int width = sr.width();
-	int height = sr.height();
-	D2D1_SIZE_U size{ (UINT32)width, (UINT32)height };
-	D2D1_BITMAP_PROPERTIES props;
-	D2D1_PIXEL_FORMAT pixelFormat = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM,
-		D2D1_ALPHA_MODE_PREMULTIPLIED);
-	props.pixelFormat = pixelFormat;
-	props.dpiX = dpiX;
-	props.dpiY = dpiY;
-	ID2D1Bitmap* bitmap;
-	if (SUCCEEDED(d->dc()->CreateBitmap(size, props, &bitmap))) {
-		UINT32 pitch = image.sizeInBytes() / height;
-		if (SUCCEEDED(bitmap->CopyFromMemory(nullptr, image.bits(), pitch))) {
-			d->dc()->DrawBitmap(bitmap,
-				D2D1::RectF(rectangle.left(),
-					rectangle.top(),
-					rectangle.right(),
-					rectangle.bottom()));
-		}
-	}
-	bitmap->Release();
+	ComPtr<ID2D1Bitmap> bitmap = cachedBitmap(image);
+	if (!bitmap)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Images);
+
+	const D2D1_RECT_F dest = toD2dRectF(rectangle);
+	const D2D1_RECT_F src = toD2dRectF(sr);
+	d->dc()->DrawBitmap(bitmap.Get(), &dest, FLOAT(state->opacity()), interpolationMode(), &src);
 }
 
-void Direct2DPaintEngine::drawLines(const QLineF* lines, int lineCount)
+template<class Line>
+void Direct2DPaintEngine::drawLineSegments(const Line* lines, int lineCount)
 {
-	if (m_pen.brush && m_pen.strokeStyle) {
-		for (int i = 0; i < lineCount; ++i) {
-			QPointF p1{ lines[i].p1() };
-			QPointF p2{ lines[i].p2() };
-			adjustLine(&p1, &p2);
-			D2D1_POINT_2F dp1 = tod2dPoint2f(p1);
-			D2D1_POINT_2F dp2 = tod2dPoint2f(p2);
-			d->dc()->DrawLine(dp1,
-				dp2,
-				m_pen.brush.Get(),
-				m_pen.qpen.widthF(),
-				m_pen.strokeStyle.Get());
-		}
+	if (!m_pen.brush || !m_pen.strokeStyle)
+		return;
+	counters(m_stats).draw(Direct2DFrameStats::Lines, lineCount);
+
+	if (m_lineBatchThreshold > 0 && lineCount >= m_lineBatchThreshold) {
+		for (int first = 0; first < lineCount; first += LINE_BATCH_CHUNK)
+			drawLineBatch(lines + first, qMin(LINE_BATCH_CHUNK, lineCount - first));
+		return;
+	}
+
+	for (int i = 0; i < lineCount; ++i) {
+		QPointF p1{ lines[i].p1() };
+		QPointF p2{ lines[i].p2() };
+		adjustLine(&p1, &p2);
+		D2D1_POINT_2F dp1 = tod2dPoint2f(p1);
+		D2D1_POINT_2F dp2 = tod2dPoint2f(p2);
+		d->dc()->DrawLine(dp1,
+			dp2,
+			m_pen.brush.Get(),
+			m_pen.qpen.widthF(),
+			m_pen.strokeStyle.Get());
 	}
+	counters(m_stats).lineSubmitted(lineCount);
 }
 
-void Direct2DPaintEngine::drawLines(const QLine* lines, int lineCount)
+// Strokes all segments as open figures of a single geometry, one DrawGeometry for the batch.
+template<class Line>
+void Direct2DPaintEngine::drawLineBatch(const Line* lines, int lineCount)
 {
-	if (m_pen.brush && m_pen.strokeStyle) {
-		for (int i = 0; i < lineCount; ++i) {
-			QPointF p1{ lines[i].p1() };
-			QPointF p2{ lines[i].p2() };
-			adjustLine(&p1, &p2);
-			D2D1_POINT_2F dp1 = tod2dPoint2f(p1);
-			D2D1_POINT_2F dp2 = tod2dPoint2f(p2);
-			d->dc()->DrawLine(dp1,
-				dp2,
-				m_pen.brush.Get(),
-				m_pen.qpen.widthF(),
-				m_pen.strokeStyle.Get());
-		}
+	ComPtr<ID2D1PathGeometry> geometry;
+	ComPtr<ID2D1GeometrySink> sink;
+	HRESULT hr = factory()->CreatePathGeometry(geometry.GetAddressOf());
+	if (SUCCEEDED(hr))
+		hr = geometry->Open(&sink);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create line batch geometry: %#lx", __FUNCTION__, hr);
+		return;
 	}
+
+	for (int i = 0; i < lineCount; ++i) {
+		QPointF p1{ lines[i].p1() };
+		QPointF p2{ lines[i].p2() };
+		adjustLine(&p1, &p2);
+		sink->BeginFigure(tod2dPoint2f(p1), D2D1_FIGURE_BEGIN_HOLLOW);
+		sink->AddLine(tod2dPoint2f(p2));
+		sink->EndFigure(D2D1_FIGURE_END_OPEN);
+	}
+	if (FAILED(sink->Close()))
+		return;
+	counters(m_stats).geometryCreated();
+
+	d->dc()->DrawGeometry(geometry.Get(),
+		m_pen.brush.Get(),
+		m_pen.qpen.widthF(),
+		m_pen.strokeStyle.Get());
+	counters(m_stats).lineBatchSubmitted();
 }
 
-void Direct2DPaintEngine::drawPath(const QPainterPath& path)
+void Direct2DPaintEngine::drawLines(const QLineF* lines, int lineCount)
 {
-	ComPtr<ID2D1PathGeometry> d2dPath;
-	if (SUCCEEDED(factory()->CreatePathGeometry(d2dPath.GetAddressOf()))) {
-		ID2D1GeometrySink* pSink = NULL;
-		if (SUCCEEDED(d2dPath->Open(&pSink))) {
-			pSink->SetFillMode(path.fillRule() == Qt::WindingFill ? D2D1_FILL_MODE_WINDING
-				: D2D1_FILL_MODE_ALTERNATE);
-
-			for (int i = 0; i < path.elementCount(); ++i) {
-				const QPainterPath::Element& element = path.elementAt(i);
-				switch (element.type) {
-				case QPainterPath::MoveToElement:
-					if (i) {
-						pSink->EndFigure(D2D1_FIGURE_END_OPEN);
-					}
-					pSink->BeginFigure(D2D1::Point2F(element.x, element.y),
-						D2D1_FIGURE_BEGIN_FILLED);
-					break;
-				case QPainterPath::LineToElement:
-					pSink->AddLine(D2D1::Point2F(element.x, element.y));
-					break;
-				case QPainterPath::CurveToElement: {
-					// Cubic Bezier curve requires two more points (CurveToDataElement)
-					if (i + 2 < path.elementCount()) {
-						const QPainterPath::Element& controlPoint1 = path.elementAt(++i);
-						const QPainterPath::Element& controlPoint2 = path.elementAt(++i);
-						pSink->AddBezier(
-							D2D1::BezierSegment(D2D1::Point2F(controlPoint1.x, controlPoint1.y),
-								D2D1::Point2F(element.x, element.y),
-								D2D1::Point2F(controlPoint2.x, controlPoint2.y)));
-					}
-				} break;
-				case QPainterPath::CurveToDataElement:
-					// This case is handled within CurveToElement
-					break;
-				}
-			}
+	flushClip();
+	drawLineSegments(lines, lineCount);
+}
 
-			pSink->EndFigure(D2D1_FIGURE_END_CLOSED);
-			std::ignore = pSink->Close();
+void Direct2DPaintEngine::drawLines(const QLine* lines, int lineCount)
+{
+	flushClip();
+	drawLineSegments(lines, lineCount);
+}
 
-			if (m_brush.brush && m_brush.qbrush != Qt::NoBrush) {
-				d->dc()->FillGeometry(d2dPath.Get(), m_brush.brush.Get());
-			}
-			if (m_pen.brush && m_pen.strokeStyle) {
-				d->dc()->DrawGeometry(d2dPath.Get(),
-					m_pen.brush.Get(),
-					m_pen.qpen.widthF(),
-					m_pen.strokeStyle.Get());
-			}
-			SafeRelease(&pSink);
-		}
-	}
+void Direct2DPaintEngine::drawPath(const QPainterPath& path)
+{
+	flushClip();
+	if (path.isEmpty())
+		return;
+
+	counters(m_stats).draw(Direct2DFrameStats::Paths, path.elementCount());
+	if (const std::shared_ptr<Direct2DGeometryEntry> entry = cachedGeometry(path))
+		drawGeometry(*entry);
 }
@@ -3,49 +3,207 @@
 #include <d2d1.h>
 #include <d2d1_1.h>
 #include <qglobal.h>
+#include <vector>
 #include <wrl.h>
 #include "qpaintengine.h"
 #include "qpainter.h"
+#include "src/direct2d/direct2dcachekeys.h"
 #include "src/direct2d/direct2ddevicecontext.h"
+#include "src/direct2d/direct2dframestats.h"
+#include "src/direct2d/direct2dimagestream.h"
 #include "src/direct2d/direct2dqthelper.h"
+#include "src/direct2d/direct2dtextlabel.h"
+#include "src/direct2d/directcontext.h"
 #include "QHash"
 
-namespace std {
-	template<>
-	struct hash<QFont>
-	{
-		inline size_t operator()(const QFont& f) const { return qHash(f); }
-	};
-}
-
 using Microsoft::WRL::ComPtr;
 static const qreal PIXEL_SNAP = 0.5;
+using Direct2DMarkerCache = Direct2DLruCache<Direct2DMarkerKey, ComPtr<ID2D1Bitmap1>>;
+// upper bound of segments merged into one batched line geometry
+static const int LINE_BATCH_CHUNK = 16384;
 class Direct2DPaintEngine final : public QPaintEngine
 {
 private:
 	IDirect2DDeviceContext* d;
-	ComPtr<ID2D1Bitmap> QPixmapToD2D1Bitmap(const QPixmap& pixmap);
 	void updateBrush(const QBrush& brush, bool force = false);
 	void updatePen(const QPen& pen, bool force = false);
+	ComPtr<ID2D1StrokeStyle1> cachedStrokeStyle(const Direct2DStrokeKey& key);
 	void initBrushAndPen();
 	ComPtr<ID2D1Brush> toD2dBrush(const QBrush& newBrush);
+	ComPtr<ID2D1Brush> cachedBrush(const QBrush& newBrush, const QPointF& origin);
 	void updateCompositionMode(QPainter::CompositionMode mode);
 	void updateBrushOrigin(const QPointF& brushOrigin);
-	void negateCurrentBrushOrigin();
-	void applyBrushOrigin(const QPointF& origin);
 	QPointF currentBrushOrigin;
 	ComPtr<ID2D1Bitmap> fromImage(QImage& image);
-	std::unordered_map<QFont, ComPtr<IDWriteFontFace>> fontCache;
-	ComPtr<IDWriteFontFace> getFont();
+	ComPtr<ID2D1Bitmap> fromImage(QImage& image, FLOAT dpiX, FLOAT dpiY);
+	ComPtr<ID2D1Bitmap> cachedBitmap(const QImage& image);
+	ComPtr<ID2D1Bitmap> cachedBitmap(const QPixmap& pixmap);
+	ComPtr<ID2D1Bitmap> uploadBitmap(const Direct2DBitmapKey& key, QImage image);
+	std::shared_ptr<Direct2DGeometryEntry> cachedGeometry(const QPainterPath& path);
+	// closed figures are filled with rule, open ones are only ever stroked
+	template<class Point>
+	std::shared_ptr<Direct2DGeometryEntry> cachedGeometry(const Point* points,
+		int count,
+		Qt::FillRule rule,
+		bool closed);
+	template<class Point>
+	bool buildPolygonGeometry(const Point* points,
+		int count,
+		Qt::FillRule rule,
+		bool closed,
+		ID2D1PathGeometry** geometry);
+	std::shared_ptr<Direct2DGeometryEntry> insertGeometry(const Direct2DPathKey& key,
+		std::shared_ptr<Direct2DGeometryEntry> entry);
+	void drawGeometry(Direct2DGeometryEntry& entry, bool fillable = true, bool realizable = true);
+	bool realizeGeometry(Direct2DGeometryEntry& entry, bool fill, bool stroke);
+	bool m_updateClipPushed;
+	// Clip requested by QPainter, one entry per intersected clip in the coordinates of its
+	// own transform.
+	struct clipEntry
+	{
+		enum Kind : quint8
+		{
+			Rect,
+			Region,
+			Path
+		};
+
+		Kind kind = Rect;
+		QRectF rect;
+		QRegion region;
+		QPainterPath path;
+		QTransform matrix;
+		bool antialias = false;
+
+		bool operator==(const clipEntry& other) const
+		{
+			if (kind != other.kind || antialias != other.antialias || matrix != other.matrix)
+				return false;
+			switch (kind) {
+			case Rect:
+				return rect == other.rect;
+			case Region:
+				return region == other.region;
+			case Path:
+				return path == other.path;
+			}
+			return false;
+		}
+	};
+	// Clip currently pushed on the device context, parallel to the front of m_clipStack.
+	struct appliedClip
+	{
+		enum Type : quint8
+		{
+			None, // could not be pushed, only kept to stay aligned with m_clipStack
+			AxisAligned,
+			Layer
+		};
+
+		clipEntry entry;
+		Type type = None;
+		ComPtr<ID2D1Layer> layer;
+		ComPtr<ID2D1Geometry> mask;
+	};
+	std::vector<clipEntry> m_clipStack;
+	std::vector<appliedClip> m_appliedClips;
+	// layers go back here when popped and are reused by the next push
+	std::vector<ComPtr<ID2D1Layer>> m_layerPool;
+	bool m_clipEnabled;
+	bool m_clipDirty;
+	void updateClip(clipEntry&& entry, Qt::ClipOperation operation);
+	// Brings the device clip in line with m_clipStack, called by every draw. Entries both
+	// stacks agree on stay pushed, so a save/restore replay only touches the changed tail.
+	inline void flushClip()
+	{
+		if (m_clipDirty)
+			syncClip();
+	}
+	void syncClip();
+	void pushClip(const clipEntry& entry);
+	void popClips(size_t count);
+	ComPtr<ID2D1Geometry> clipMask(const clipEntry& entry);
+	int m_realizationThreshold;
+	int m_lineBatchThreshold;
+	template<class Line>
+	void drawLineSegments(const Line* lines, int lineCount);
+	template<class Line>
+	void drawLineBatch(const Line* lines, int lineCount);
+	int m_pointBatchThreshold;
+	template<class Point>
+	void drawPenPoints(const Point* points, int pointCount);
+	int m_polygonCacheThreshold;
+	// last polygon too small for the geometry cache, only its storage is reused
+	Direct2DGeometryEntry m_scratchPolygon;
+	template<class Point>
+	void drawPolygonPoints(const Point* points, int pointCount, QPaintEngine::PolygonDrawMode mode);
+	int m_shapeBatchThreshold;
+	template<class Rect>
+	void drawRectBatch(const Rect* rects, int rectCount);
+	// fillRects brush, its color is set per rect
+	ComPtr<ID2D1SolidColorBrush> m_fillRectsBrush;
+	void drawShapes(const QRectF* rects, int rectCount, qreal xRadius, qreal yRadius, bool ellipse);
+#ifndef __MINGW64__
+	// markers are rasterized on a private context, sprites are drawn in batches on d->dc()
+	ComPtr<ID2D1DEVICECONTEXT> m_markerContext;
+	Direct2DMarkerCache m_markers;
+	ComPtr<ID2D1SpriteBatch> m_spriteBatch;
+	std::vector<D2D1_RECT_F> m_spriteRects;
+	std::vector<D2D1_COLOR_F> m_spriteColors;
+	ID2D1Bitmap1* markerBitmap(const Direct2DMarkerKey& key);
+	bool ensureSpriteBatch();
+	void drawSpriteBatch(ID2D1Bitmap* bitmap);
+	// draws m_spriteRects[0, count) with marker, all tinted with color
+	bool drawSprites(ID2D1Bitmap* marker, int count, const QColor& color);
+	// draws m_spriteRects[0, count) with marker tinted with m_spriteColors[0, count)
+	bool drawSprites(ID2D1Bitmap* marker, int count);
+	// stretched 1x1 white marker, solid rects of any size batch through it
+	inline ID2D1Bitmap1* pixelMarker() { return markerBitmap(Direct2DMarkerKey()); }
+	// rects can become sprites: aliased, no rotation and enough of them
+	inline bool rectSpritesAllowed(int rectCount) const
+	{
+		return m_shapeBatchThreshold > 0 && rectCount >= m_shapeBatchThreshold
+			&& !(state->renderHints() & QPainter::Antialiasing)
+			&& state->transform().type() <= QTransform::TxScale;
+	}
+	template<class Point>
+	bool drawPointSprites(const Point* points, int pointCount, int size, bool round);
+	bool drawShapeSprites(const QRectF* rects,
+		int rectCount,
+		Direct2DMarkerKey::Shape shape,
+		qreal xRadius,
+		qreal yRadius);
+#endif
+	// converted pixels of uploads that are not B8G8R8A8 premultiplied already
+	Direct2DStagingPool m_staging;
+	Direct2DFrameCounterState m_stats;
+	QScopedPointer<Direct2DFrameStatsNotifier> m_statsNotifier;
+	ComPtr<IDWriteFontFace> getFont(const QFont& font);
+	std::shared_ptr<const Direct2DGlyphRun> cachedGlyphRun(const QFont& font,
+		const QString& text,
+		int flags);
+	// drawTextRuns scratch, kept so batches of labels do not allocate every frame. Group ids of
+	// (font, color) pairs stay assigned across calls, the table is reset once it grows past
+	// kMaxLabelGroups.
+	static constexpr int kMaxLabelGroups = 256;
+	QHash<QPair<QFont, QRgb>, int> m_labelGroupIds;
+	std::vector<QFont> m_labelGroupFonts;
+	std::vector<int> m_labelGroups;
+	std::vector<int> m_labelOrder;
+	std::vector<UINT16> m_runIndices;
+	std::vector<FLOAT> m_runAdvances;
+	std::vector<DWRITE_GLYPH_OFFSET> m_runOffsets;
 	struct brush
 	{
 		QBrush qbrush;
+		qreal opacity = 1.0;
 		ComPtr<ID2D1Brush> brush;
 		ID2D1Brush** getReset() { return brush.ReleaseAndGetAddressOf(); }
 	};
 	struct pen
 	{
 		QPen qpen;
+		qreal opacity = 1.0;
 		ComPtr<ID2D1Brush> brush;
 		ComPtr<ID2D1StrokeStyle1> strokeStyle;
 		void reset()
@@ -135,4 +293,61 @@ public:
 		D2D1_BITMAP_INTERPOLATION_MODE interpolationMode,
 		const D2D1_RECT_F* src);
 	void drawLinePath(const QPointF* path, const size_t count);
+	// Draws many labels with as few glyph runs as possible: labels sharing font and color go
+	// into one run, placed with glyph offsets. Runs are drawn group by group, so overlapping
+	// labels of different groups may stack in another order than they were given.
+	void drawTextRuns(const Direct2DTextLabel* labels, int labelCount);
+	// drawTextRuns on the engine behind painter, false when it is not a Direct2DPaintEngine
+	static bool drawTextRuns(QPainter& painter, const Direct2DTextLabel* labels, int labelCount);
+	// Ellipses inscribed in rects, and rounded rects, with the current pen and brush in one
+	// call. At least shapeBatchThreshold() shapes of one size, with a solid brush or a solid pen
+	// but not both, under a translation are drawn as sprites of a pre-rasterized marker.
+	void drawEllipses(const QRectF* rects, int rectCount);
+	static bool drawEllipses(QPainter& painter, const QRectF* rects, int rectCount);
+	void drawRoundedRects(const QRectF* rects, int rectCount, qreal xRadius, qreal yRadius);
+	static bool drawRoundedRects(QPainter& painter,
+		const QRectF* rects,
+		int rectCount,
+		qreal xRadius,
+		qreal yRadius);
+	// Fills rects[i] with colors[i], ignoring pen and brush. Large aliased batches are one
+	// sprite batch, so heatmaps and bar charts with a color per cell cost one draw call.
+	void fillRects(const QRectF* rects, const QColor* colors, int rectCount);
+	static bool fillRects(QPainter& painter, const QRectF* rects, const QColor* colors, int rectCount);
+	// Draws the latest frame uploaded to stream, scaled to target.
+	void drawImageStream(const QRectF& target, const Direct2DImageStream& stream);
+	static bool drawImageStream(QPainter& painter,
+		const QRectF& target,
+		const Direct2DImageStream& stream);
+	// engine behind painter with the painter state applied, nullptr for other engines
+	static Direct2DPaintEngine* fromPainter(QPainter& painter);
+	// Paths drawn this many times in a row at the same scale are upgraded to geometry
+	// realizations, 0 disables realizations.
+	inline void setGeometryRealizationThreshold(int draws) { m_realizationThreshold = draws; }
+	inline int geometryRealizationThreshold() const { return m_realizationThreshold; }
+	// drawLines calls with at least this many segments are stroked as one geometry per
+	// LINE_BATCH_CHUNK segments instead of one DrawLine each, 0 disables batching.
+	inline void setLineBatchThreshold(int lines) { m_lineBatchThreshold = lines; }
+	inline int lineBatchThreshold() const { return m_lineBatchThreshold; }
+	// drawPoints calls with at least this many points and a solid pen are drawn as one sprite
+	// batch of a pre-rasterized marker, 0 disables sprites.
+	inline void setPointBatchThreshold(int points) { m_pointBatchThreshold = points; }
+	inline int pointBatchThreshold() const { return m_pointBatchThreshold; }
+	// drawPolygon calls with fewer points are built uncached, they are rarely drawn twice and
+	// would only evict the shapes worth keeping. 0 caches every polygon.
+	inline void setPolygonCacheThreshold(int points) { m_polygonCacheThreshold = points; }
+	inline int polygonCacheThreshold() const { return m_polygonCacheThreshold; }
+	// drawRects, fillRects, drawEllipses and drawRoundedRects batches from this size on may
+	// become sprites, 0 disables them.
+	inline void setShapeBatchThreshold(int shapes) { m_shapeBatchThreshold = shapes; }
+	inline int shapeBatchThreshold() const { return m_shapeBatchThreshold; }
+	// images uploaded to the GPU since begin(), cumulative totals are in DirectContext::bitmapCache()
+	inline int frameImageUploads() const { return int(m_stats.current.bitmapCreations); }
+	inline qint64 frameUploadedBytes() const { return qint64(m_stats.current.uploadedBytes); }
+	// whether the engine was built with DIRECT2D_ENGINE_STATS
+	static bool hasFrameStats();
+	// Counters of the last finished frame, all zero unless built with DIRECT2D_ENGINE_STATS.
+	inline const Direct2DFrameStats& frameStats() const { return m_stats.last; }
+	// created on first use, emits frameFinished() from every end() afterwards
+	Direct2DFrameStatsNotifier* frameStatsNotifier();
 };
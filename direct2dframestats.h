@@ -0,0 +1,161 @@
+#ifndef DIRECT2DFRAMESTATS_H
+#define DIRECT2DFRAMESTATS_H
+
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QObject>
+#include <array>
+
+struct Direct2DFrameStats
+{
+	enum Primitive : int
+	{
+		Lines,
+		Rects,
+		Points,
+		Polygons,
+		Ellipses,
+		Paths,
+		Images,
+		Pixmaps,
+		TiledPixmaps,
+		Text,
+		PrimitiveCount
+	};
+
+	// engine draw calls and the number of lines, rects, points... they carried
+	std::array<quint32, PrimitiveCount> drawCalls = {};
+	std::array<quint64, PrimitiveCount> drawItems = {};
+	// what drawLines submitted to the device context: one DrawLine per segment below the line
+	// batch threshold, one DrawGeometry per batch chunk from it on
+	quint32 lineSubmissions = 0;
+	quint32 lineBatchSubmissions = 0;
+	// device resources created because they were not found in a cache
+	quint32 brushCreations = 0;
+	quint32 strokeStyleCreations = 0;
+	quint32 geometryCreations = 0;
+	quint32 bitmapCreations = 0;
+	quint64 uploadedBytes = 0;
+	quint32 transformChanges = 0;
+	quint32 antialiasChanges = 0;
+	// time between begin() and end() on the painting thread
+	qint64 cpuTimeNs = 0;
+
+	inline quint32 totalDrawCalls() const
+	{
+		quint32 total = 0;
+		for (quint32 calls : drawCalls)
+			total += calls;
+		return total;
+	}
+
+	static inline const char* primitiveName(Primitive primitive)
+	{
+		static const char* const names[PrimitiveCount] = { "lines", "rects", "points", "polygons",
+			"ellipses", "paths", "images", "pixmaps", "tiledPixmaps", "text" };
+		return primitive >= 0 && primitive < PrimitiveCount ? names[primitive] : "";
+	}
+};
+
+Q_DECLARE_METATYPE(Direct2DFrameStats)
+
+// Storage of the counters, the same in every build so the layout of the engine does not
+// depend on the counting policy.
+struct Direct2DFrameCounterState
+{
+	Direct2DFrameStats current;
+	Direct2DFrameStats last;
+	QElapsedTimer timer;
+};
+
+// Compile-time counting policy over a Direct2DFrameCounterState. Only the engine source picks
+// the policy (DIRECT2D_ENGINE_STATS, set by the build), Direct2DFrameCounters<false> keeps
+// nothing but the uploads, which back Direct2DPaintEngine::frameImageUploads() in every build.
+template<bool Enabled>
+class Direct2DFrameCounters
+{
+private:
+	Direct2DFrameCounterState& m_state;
+
+public:
+	static constexpr bool enabled = Enabled;
+
+	explicit Direct2DFrameCounters(Direct2DFrameCounterState& state)
+		: m_state(state)
+	{}
+
+	inline void beginFrame()
+	{
+		m_state.current = Direct2DFrameStats();
+		if constexpr (Enabled)
+			m_state.timer.start();
+	}
+	inline void endFrame()
+	{
+		if constexpr (Enabled) {
+			m_state.current.cpuTimeNs = m_state.timer.nsecsElapsed();
+			m_state.last = m_state.current;
+		}
+	}
+	inline void draw(Direct2DFrameStats::Primitive primitive, qint64 items = 1)
+	{
+		if constexpr (Enabled) {
+			++m_state.current.drawCalls[primitive];
+			m_state.current.drawItems[primitive] += quint64(items);
+		}
+	}
+	inline void lineSubmitted(int lines = 1)
+	{
+		if constexpr (Enabled)
+			m_state.current.lineSubmissions += quint32(lines);
+	}
+	inline void lineBatchSubmitted()
+	{
+		if constexpr (Enabled)
+			++m_state.current.lineBatchSubmissions;
+	}
+	inline void brushCreated()
+	{
+		if constexpr (Enabled)
+			++m_state.current.brushCreations;
+	}
+	inline void strokeStyleCreated()
+	{
+		if constexpr (Enabled)
+			++m_state.current.strokeStyleCreations;
+	}
+	inline void geometryCreated()
+	{
+		if constexpr (Enabled)
+			++m_state.current.geometryCreations;
+	}
+	inline void bitmapCreated(qint64 bytes)
+	{
+		++m_state.current.bitmapCreations;
+		m_state.current.uploadedBytes += quint64(bytes);
+	}
+	inline void transformChanged()
+	{
+		if constexpr (Enabled)
+			++m_state.current.transformChanges;
+	}
+	inline void antialiasChanged()
+	{
+		if constexpr (Enabled)
+			++m_state.current.antialiasChanges;
+	}
+};
+
+// Emits the counters of every frame from Direct2DPaintEngine::end(), only created on request.
+class Direct2DFrameStatsNotifier : public QObject
+{
+	Q_OBJECT
+
+public:
+	using QObject::QObject;
+
+signals:
+	void frameFinished(const Direct2DFrameStats& stats);
+};
+
+#endif // DIRECT2DFRAMESTATS_H
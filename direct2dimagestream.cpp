@@ -0,0 +1,110 @@
+#include "direct2dimagestream.h"
+#include "direct2dqthelper.h"
+#include "directcontext.h"
+#include "qlogging.h"
+
+Direct2DImageStream::Direct2DImageStream(const QSize& size, int slotCount, FLOAT dpiX, FLOAT dpiY)
+	: m_size(size)
+	, m_dpiX(dpiX)
+	, m_dpiY(dpiY)
+	, m_slotCount(qMax(2, slotCount))
+	, m_next(0)
+	, m_latest(-1)
+	, m_frames(0)
+{}
+
+bool Direct2DImageStream::ensureSlots()
+{
+	if (!m_slots.empty())
+		return true;
+
+	HRESULT hr;
+	if (!m_context) {
+		hr = DirectContext::instance().d2dDevice()->CreateDeviceContext(
+			D2D1_DEVICE_CONTEXT_OPTIONS_NONE,
+			m_context.ReleaseAndGetAddressOf());
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create stream device context: %#lx", __FUNCTION__, hr);
+			return false;
+		}
+	}
+
+	const D2D1_BITMAP_PROPERTIES1 properties = D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_NONE,
+		D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+		m_dpiX,
+		m_dpiY);
+	m_slots.resize(size_t(m_slotCount));
+	for (ComPtr<ID2D1Bitmap1>& slot : m_slots) {
+		hr = m_context->CreateBitmap(D2D1::SizeU(UINT32(m_size.width()), UINT32(m_size.height())),
+			nullptr,
+			0,
+			properties,
+			&slot);
+		if (FAILED(hr)) {
+			qWarning("%s: Could not create stream bitmap: %#lx", __FUNCTION__, hr);
+			m_slots.clear();
+			return false;
+		}
+	}
+	m_next = 0;
+	m_latest = -1;
+	return true;
+}
+
+bool Direct2DImageStream::supportsFormat(QImage::Format format)
+{
+	Direct2DPixelFormat converted;
+	return format == QImage::Format_ARGB32_Premultiplied || format == QImage::Format_RGB32
+		|| toDirect2DPixelFormat(format, &converted);
+}
+
+bool Direct2DImageStream::upload(const QImage& frame)
+{
+	if (frame.size() != m_size) {
+		qWarning("%s: Frame size does not match the stream", __FUNCTION__);
+		return false;
+	}
+	if (!supportsFormat(frame.format())) {
+		qWarning("%s: Unsupported frame format %d", __FUNCTION__, int(frame.format()));
+		return false;
+	}
+	if (!ensureSlots())
+		return false;
+
+	// RGB32 and ARGB32_Premultiplied are B8G8R8A8 premultiplied in memory already
+	const void* bits = frame.constBits();
+	UINT32 pitch = UINT32(frame.bytesPerLine());
+	Direct2DPixelFormat format;
+	if (toDirect2DPixelFormat(frame.format(), &format)) {
+		m_staging.resize(size_t(m_size.width()) * size_t(m_size.height()));
+		direct2dConvertImage(format,
+			frame.constBits(),
+			size_t(frame.bytesPerLine()),
+			m_staging.data(),
+			size_t(m_size.width()) * sizeof(uint32_t),
+			m_size.width(),
+			m_size.height());
+		bits = m_staging.data();
+		pitch = UINT32(m_size.width()) * sizeof(uint32_t);
+	}
+
+	ID2D1Bitmap1* slot = m_slots[size_t(m_next)].Get();
+	HRESULT hr = slot->CopyFromMemory(nullptr, bits, pitch);
+	if (FAILED(hr)) {
+		qWarning("%s: Could not upload stream frame: %#lx", __FUNCTION__, hr);
+		return false;
+	}
+
+	m_latest = m_next;
+	m_next = (m_next + 1) % m_slotCount;
+	++m_frames;
+	return true;
+}
+
+void Direct2DImageStream::reset()
+{
+	m_slots.clear();
+	m_context.Reset();
+	m_next = 0;
+	m_latest = -1;
+}
@@ -0,0 +1,52 @@
+#ifndef DIRECT2DIMAGESTREAM_H
+#define DIRECT2DIMAGESTREAM_H
+
+#include <QImage>
+#include <vector>
+#include "src/direct2d/direct2ddevicecontext.h"
+
+// Ring of device bitmaps of one size for content replaced every frame, e.g. camera video.
+// upload() copies a frame into the next slot of the ring and makes it the latest, nothing is
+// allocated once the ring and the conversion buffer exist. Frames have to be in one of the
+// formats of supportsFormat(), convert others up front. Drawing the latest slot while the next one is written keeps
+// uploads from waiting on bitmaps still referenced by queued draw commands.
+class Direct2DImageStream
+{
+private:
+	QSize m_size;
+	FLOAT m_dpiX;
+	FLOAT m_dpiY;
+	int m_slotCount;
+	// bitmaps are device resources, the private context only creates and fills them
+	ComPtr<ID2D1DEVICECONTEXT> m_context;
+	std::vector<ComPtr<ID2D1Bitmap1>> m_slots;
+	int m_next;
+	int m_latest;
+	quint64 m_frames;
+	// frames not already in BGRA order are converted here, sized once for the stream
+	std::vector<uint32_t> m_staging;
+	bool ensureSlots();
+
+public:
+	explicit Direct2DImageStream(const QSize& size,
+		int slotCount = 3,
+		FLOAT dpiX = 96.0f,
+		FLOAT dpiY = 96.0f);
+
+	// RGB32 and ARGB32_Premultiplied, which are copied as is, and the direct2dConvertScanline formats
+	static bool supportsFormat(QImage::Format format);
+	// frame must be size() large and in a supported format, false otherwise
+	bool upload(const QImage& frame);
+	// most recent completed upload, nullptr before the first one
+	inline ID2D1Bitmap1* latest() const
+	{
+		return m_latest >= 0 ? m_slots[size_t(m_latest)].Get() : nullptr;
+	}
+	inline QSize size() const { return m_size; }
+	inline int slotCount() const { return m_slotCount; }
+	inline quint64 frameCount() const { return m_frames; }
+	// drops the device bitmaps, they are created again by the next upload (e.g. after device loss)
+	void reset();
+};
+
+#endif // DIRECT2DIMAGESTREAM_H
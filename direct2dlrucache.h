@@ -0,0 +1,224 @@
+#ifndef DIRECT2DLRUCACHE_H
+#define DIRECT2DLRUCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+// Counters kept by every Direct2DLruCache. totalCost/maxCost are in whatever unit the
+// cache was budgeted in (entries for brushes, bytes for bitmaps and geometries).
+struct Direct2DCacheStats
+{
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+	std::uint64_t evictions = 0;
+	std::uint64_t insertedCost = 0;
+	size_t totalCost = 0;
+	size_t maxCost = 0;
+	size_t count = 0;
+
+	inline double hitRate() const
+	{
+		const std::uint64_t lookups = hits + misses;
+		return lookups ? double(hits) / double(lookups) : 0.0;
+	}
+};
+
+// Bounded least-recently-used cache. It only knows about keys, values and costs, so it has no
+// Direct2D dependency and the eviction policy can be exercised with any value type.
+template<class Key, class Value, class Hash = std::hash<Key>>
+class Direct2DLruCache
+{
+private:
+	struct entry
+	{
+		Key key;
+		Value value;
+		size_t cost;
+	};
+	using entryList = std::list<entry>;
+
+	// front is the most recently used entry
+	entryList m_entries;
+	std::unordered_map<Key, typename entryList::iterator, Hash> m_index;
+	size_t m_maxCost;
+	size_t m_totalCost;
+	Direct2DCacheStats m_stats;
+
+	void trim(size_t budget)
+	{
+		while (m_totalCost > budget && !m_entries.empty()) {
+			entry& victim = m_entries.back();
+			m_totalCost -= victim.cost;
+			m_index.erase(victim.key);
+			m_entries.pop_back();
+			++m_stats.evictions;
+		}
+	}
+
+public:
+	explicit Direct2DLruCache(size_t maxCost)
+		: m_maxCost(maxCost)
+		, m_totalCost(0)
+	{}
+
+	// Returns the cached value and marks it as most recently used, or nullptr on a miss.
+	// The pointer stays valid until the next insert/remove/clear.
+	Value* find(const Key& key)
+	{
+		auto it = m_index.find(key);
+		if (it == m_index.end()) {
+			++m_stats.misses;
+			return nullptr;
+		}
+		++m_stats.hits;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return &it->second->value;
+	}
+
+	// Returns the stored value, or nullptr if it costs more than the whole budget and was not kept.
+	Value* insert(const Key& key, Value value, size_t cost = 1)
+	{
+		remove(key);
+		if (cost > m_maxCost)
+			return nullptr;
+
+		trim(m_maxCost - cost);
+		m_entries.push_front(entry{ key, std::move(value), cost });
+		m_index.emplace(key, m_entries.begin());
+		m_totalCost += cost;
+		m_stats.insertedCost += cost;
+		return &m_entries.front().value;
+	}
+
+	// Neither counts a lookup nor changes the order.
+	inline bool contains(const Key& key) const { return m_index.find(key) != m_index.end(); }
+
+	bool remove(const Key& key)
+	{
+		auto it = m_index.find(key);
+		if (it == m_index.end())
+			return false;
+		m_totalCost -= it->second->cost;
+		m_entries.erase(it->second);
+		m_index.erase(it);
+		return true;
+	}
+
+	template<class Predicate>
+	void removeIf(Predicate&& predicate)
+	{
+		for (auto it = m_entries.begin(); it != m_entries.end();) {
+			if (predicate(it->key, it->value)) {
+				m_totalCost -= it->cost;
+				m_index.erase(it->key);
+				it = m_entries.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	void clear()
+	{
+		m_index.clear();
+		m_entries.clear();
+		m_totalCost = 0;
+	}
+
+	void setMaxCost(size_t maxCost)
+	{
+		m_maxCost = maxCost;
+		trim(m_maxCost);
+	}
+
+	inline size_t maxCost() const { return m_maxCost; }
+	inline size_t totalCost() const { return m_totalCost; }
+	inline size_t count() const { return m_entries.size(); }
+
+	Direct2DCacheStats stats() const
+	{
+		Direct2DCacheStats result = m_stats;
+		result.totalCost = m_totalCost;
+		result.maxCost = m_maxCost;
+		result.count = m_entries.size();
+		return result;
+	}
+
+	void resetStats() { m_stats = Direct2DCacheStats(); }
+};
+
+// Direct2DLruCache behind a mutex, for caches shared by engines on several render threads.
+// Values are handed out by copy so they stay valid whatever other threads evict, which suits
+// reference counted values like ComPtr. Creating a value on a miss happens outside the lock:
+// two threads missing the same key both create it and the last insert wins.
+template<class Key, class Value, class Hash = std::hash<Key>>
+class Direct2DConcurrentLruCache
+{
+private:
+	mutable std::mutex m_mutex;
+	Direct2DLruCache<Key, Value, Hash> m_cache;
+
+public:
+	explicit Direct2DConcurrentLruCache(size_t maxCost)
+		: m_cache(maxCost)
+	{}
+
+	std::optional<Value> find(const Key& key)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (Value* value = m_cache.find(key))
+			return *value;
+		return std::nullopt;
+	}
+
+	void insert(const Key& key, Value value, size_t cost = 1)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.insert(key, std::move(value), cost);
+	}
+
+	bool remove(const Key& key)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cache.remove(key);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.clear();
+	}
+
+	void setMaxCost(size_t maxCost)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.setMaxCost(maxCost);
+	}
+
+	size_t count() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cache.count();
+	}
+
+	Direct2DCacheStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cache.stats();
+	}
+
+	void resetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.resetStats();
+	}
+};
+
+#endif // DIRECT2DLRUCACHE_H
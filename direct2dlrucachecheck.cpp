@@ -0,0 +1,206 @@
+// Checks the eviction policy of Direct2DLruCache with a fake resource factory standing in for
+// the device: the same find-or-create pattern the engine uses for brushes, stroke styles and
+// bitmaps, counting how many resources get created. Also runs Direct2DConcurrentLruCache from
+// several threads at once. Only depends on the standard library, e.g.
+//   g++ -std=c++17 -O2 -pthread direct2dlrucachecheck.cpp
+//   cl /std:c++17 /O2 /EHsc direct2dlrucachecheck.cpp
+// Exits with 0 when every check passes.
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "direct2dlrucache.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+	if (!ok) {
+		std::printf("%s\n", what);
+		failures++;
+	}
+}
+
+// Stands in for ID2D1DeviceContext::CreateXxx, values are shared like ComPtr
+struct FakeFactory
+{
+	int created = 0;
+
+	std::shared_ptr<int> create(int key)
+	{
+		created++;
+		return std::make_shared<int>(key);
+	}
+};
+
+static std::shared_ptr<int> cachedResource(Direct2DLruCache<int, std::shared_ptr<int>>& cache,
+	FakeFactory& factory,
+	int key)
+{
+	if (std::shared_ptr<int>* cached = cache.find(key))
+		return *cached;
+	std::shared_ptr<int> result = factory.create(key);
+	cache.insert(key, result);
+	return result;
+}
+
+static void checkFactory()
+{
+	FakeFactory factory;
+	Direct2DLruCache<int, std::shared_ptr<int>> cache(4);
+
+	// a frame that keeps reusing four resources only creates them once
+	for (int frame = 0; frame < 100; frame++) {
+		for (int key = 0; key < 4; key++)
+			check(*cachedResource(cache, factory, key) == key, "factory: wrong resource for a key");
+	}
+	check(factory.created == 4, "factory: a resource in budget was created again");
+	check(cache.stats().hits == 396 && cache.stats().misses == 4, "factory: wrong hit and miss counts");
+
+	// touching 0 makes 1 the least recently used one, so the fifth resource evicts 1
+	cachedResource(cache, factory, 0);
+	cachedResource(cache, factory, 4);
+	check(cache.count() == 4 && cache.stats().evictions == 1, "factory: budget not kept");
+	check(cache.find(1) == nullptr, "factory: evicted a recently used resource");
+	check(cache.find(0) && cache.find(2) && cache.find(3) && cache.find(4), "factory: lost a resource in budget");
+
+	// an evicted resource is still alive for whoever holds it, and is created again on the next use
+	const std::shared_ptr<int> held = cachedResource(cache, factory, 5);
+	cachedResource(cache, factory, 6);
+	cachedResource(cache, factory, 7);
+	cachedResource(cache, factory, 8);
+	cachedResource(cache, factory, 9);
+	check(*held == 5, "factory: an evicted resource was destroyed while held");
+	const int createdBefore = factory.created;
+	cachedResource(cache, factory, 5);
+	check(factory.created == createdBefore + 1, "factory: an evicted resource was not created again");
+
+	// cycling through one more resource than the budget misses every time, the worst case
+	Direct2DLruCache<int, std::shared_ptr<int>> small(3);
+	FakeFactory cycling;
+	for (int i = 0; i < 40; i++)
+		cachedResource(small, cycling, i % 4);
+	check(cycling.created == 40 && small.stats().hits == 0, "factory: LRU order kept a resource it should evict");
+
+	// removeIf drops matching entries without counting evictions
+	cache.removeIf([](int key, const std::shared_ptr<int>&) { return key % 2 == 1; });
+	check(cache.find(5) == nullptr && cache.find(7) == nullptr && cache.find(9) == nullptr, "removeIf kept an entry");
+	check(cache.find(8) && cache.count() == 1, "removeIf dropped an entry");
+	check(cache.totalCost() == cache.count(), "removeIf lost track of the cost");
+
+	// too big for the whole budget: not kept and nothing else is evicted for it
+	const size_t count = cache.count();
+	check(cache.insert(100, factory.create(100), 5) == nullptr, "an entry over budget was kept");
+	check(cache.count() == count, "an entry over budget evicted others");
+
+	cache.setMaxCost(1);
+	check(cache.count() == 1 && cache.totalCost() == 1, "setMaxCost did not trim");
+	cache.clear();
+	check(cache.count() == 0 && cache.totalCost() == 0, "clear kept entries");
+}
+
+// the geometry and bitmap caches are budgeted in bytes: entries of different sizes leave in
+// least recently used order until the newcomer fits, however many that takes
+static void checkByteBudget()
+{
+	Direct2DLruCache<int, int> cache(1000);
+	cache.insert(0, 0, 100);
+	cache.insert(1, 1, 300);
+	cache.insert(2, 2, 200);
+	cache.insert(3, 3, 400);
+	check(cache.totalCost() == 1000 && cache.count() == 4, "bytes: a full budget was trimmed");
+
+	// 0 becomes the most recently used, 1 and 2 are the oldest
+	check(cache.find(0) != nullptr, "bytes: lost an entry in budget");
+	cache.insert(4, 4, 450);
+	check(!cache.contains(1) && !cache.contains(2), "bytes: kept an older entry than needed");
+	check(cache.contains(0) && cache.contains(3) && cache.contains(4), "bytes: evicted more than needed");
+	check(cache.totalCost() == 950 && cache.stats().evictions == 2, "bytes: wrong cost after evicting");
+
+	// re-inserting a key replaces its cost instead of adding to it
+	cache.insert(3, 3, 50);
+	check(cache.totalCost() == 600 && cache.count() == 3, "bytes: re-insert kept the old cost");
+
+	// one large entry flushes everything older, oldest first
+	cache.insert(5, 5, 900);
+	check(cache.count() == 2 && cache.contains(3) && cache.contains(5), "bytes: large entry evicted out of order");
+
+	// shrinking the budget evicts from the least recently used end
+	cache.find(3);
+	cache.setMaxCost(100);
+	check(cache.count() == 1 && cache.contains(3), "bytes: shrinking evicted the recently used entry");
+	check(cache.stats().insertedCost == 100 + 300 + 200 + 400 + 450 + 50 + 900, "bytes: inserted cost not counted");
+}
+
+// The font face and glyph run caches are shared by every render thread: lookups and inserts race,
+// values must always match their key and the budget must hold whatever the interleaving.
+static void checkConcurrent()
+{
+	const int threadCount = int(std::max(4u, std::thread::hardware_concurrency()));
+	const int keys = 256;
+	const size_t budget = 64;
+	Direct2DConcurrentLruCache<int, std::shared_ptr<const std::string>> cache(budget);
+	std::atomic<int> created{ 0 };
+	std::atomic<int> wrong{ 0 };
+	std::atomic<int> overBudget{ 0 };
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++) {
+		threads.emplace_back([&, t]() {
+			unsigned seed = 0x2d2du + unsigned(t);
+			for (int i = 0; i < 20000; i++) {
+				seed = seed * 1664525u + 1013904223u;
+				// a hot set every thread shares and a long tail that keeps evicting
+				const int key = (seed >> 8) % 4 ? int((seed >> 12) % 16) : int((seed >> 12) % keys);
+				std::shared_ptr<const std::string> value;
+				if (std::optional<std::shared_ptr<const std::string>> cached = cache.find(key)) {
+					value = *cached;
+				}
+				else {
+					created++;
+					value = std::make_shared<const std::string>(std::to_string(key));
+					cache.insert(key, value);
+				}
+				if (*value != std::to_string(key))
+					wrong++;
+				if (cache.count() > budget)
+					overBudget++;
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	check(wrong == 0, "concurrent: a lookup returned the value of another key");
+	check(overBudget == 0, "concurrent: the cache grew over its budget");
+	const Direct2DCacheStats stats = cache.stats();
+	check(stats.count <= budget && stats.totalCost == stats.count, "concurrent: cost out of step with the entries");
+	check(stats.hits + stats.misses == std::uint64_t(threadCount) * 20000, "concurrent: lost a lookup");
+	check(stats.misses == std::uint64_t(created.load()), "concurrent: misses differ from the values created");
+	check(stats.hits > stats.misses, "concurrent: the hot set kept missing");
+
+	// the least recently used entries are the ones that go, also behind the lock
+	Direct2DConcurrentLruCache<int, int> small(3);
+	small.insert(1, 1);
+	small.insert(2, 2);
+	small.insert(3, 3);
+	small.find(1);
+	small.insert(4, 4);
+	check(!small.find(2) && small.find(1) && small.find(3) && small.find(4), "concurrent: evicted out of LRU order");
+	small.setMaxCost(1);
+	check(small.count() == 1 && small.find(4), "concurrent: setMaxCost kept the wrong entry");
+	small.clear();
+	check(small.count() == 0, "concurrent: clear kept entries");
+}
+
+int main()
+{
+	checkFactory();
+	checkByteBudget();
+	checkConcurrent();
+	std::printf("lru cache: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
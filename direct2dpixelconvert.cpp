@@ -0,0 +1,410 @@
+#include "direct2dpixelconvert.h"
+#include <atomic>
+#include <cstring>
+
+// The x86 kernels are always compiled, each with its own target, and picked at run time from
+// what the CPU supports: MSVC only defines __AVX2__ under /arch:AVX2 and never __SSE4_1__, so
+// compile-time selection leaves a default Windows build on the scalar path.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define DIRECT2D_CONVERT_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DIRECT2D_TARGET_SSE4
+#define DIRECT2D_TARGET_AVX2
+#else
+#define DIRECT2D_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define DIRECT2D_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DIRECT2D_CONVERT_NEON
+#endif
+
+namespace {
+	enum isa : int
+	{
+		Scalar,
+		Sse4,
+		Avx2,
+		Neon
+	};
+
+	const char* const isaNames[] = { "scalar", "sse4.1", "avx2", "neon" };
+
+	isa detectIsa()
+	{
+#if defined(DIRECT2D_CONVERT_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		const int maxLeaf = info[0];
+		__cpuid(info, 1);
+		const bool sse4 = (info[2] & (1 << 19)) != 0;
+		// AVX2 also needs the OS to save the YMM registers
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx2 = false;
+		if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		const bool sse4 = __builtin_cpu_supports("sse4.1");
+		const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+		return avx2 ? Avx2 : sse4 ? Sse4 : Scalar;
+#elif defined(DIRECT2D_CONVERT_NEON)
+		return Neon;
+#else
+		return Scalar;
+#endif
+	}
+
+	const isa supportedIsa = detectIsa();
+	std::atomic<int> activeIsa{ supportedIsa };
+}
+
+// c * a / 255 rounded the way qPremultiply does it
+static inline uint32_t premultiplyChannel(uint32_t c, uint32_t a)
+{
+	const uint32_t x = c * a;
+	return (x + (x >> 8) + 0x80) >> 8;
+}
+
+static inline uint32_t premultiply(uint32_t p)
+{
+	const uint32_t a = p >> 24;
+	return (a << 24) | (premultiplyChannel((p >> 16) & 0xff, a) << 16)
+		| (premultiplyChannel((p >> 8) & 0xff, a) << 8) | premultiplyChannel(p & 0xff, a);
+}
+
+// 16 bit channel to 8 bit, v / 257 rounded
+static inline uint32_t div257(uint32_t v)
+{
+	return (v - (v >> 8) + 0x80) >> 8;
+}
+
+static void convertScalar(Direct2DPixelFormat format,
+	const uint8_t* src,
+	uint32_t* dst,
+	int first,
+	int width)
+{
+	switch (format) {
+	case Direct2DPixelFormat::ARGB32: {
+		const uint32_t* s = reinterpret_cast<const uint32_t*>(src);
+		for (int i = first; i < width; i++)
+			dst[i] = premultiply(s[i]);
+	} break;
+	case Direct2DPixelFormat::RGBX8888:
+		for (int i = first; i < width; i++) {
+			const uint8_t* p = src + size_t(i) * 4;
+			dst[i] = 0xff000000u | (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+		}
+		break;
+	case Direct2DPixelFormat::RGB888:
+		for (int i = first; i < width; i++) {
+			const uint8_t* p = src + size_t(i) * 3;
+			dst[i] = 0xff000000u | (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+		}
+		break;
+	case Direct2DPixelFormat::Grayscale8:
+		for (int i = first; i < width; i++)
+			dst[i] = 0xff000000u | (uint32_t(src[i]) * 0x010101u);
+		break;
+	case Direct2DPixelFormat::RGBA64: {
+		const uint16_t* s = reinterpret_cast<const uint16_t*>(src);
+		for (int i = first; i < width; i++) {
+			const uint16_t* p = s + size_t(i) * 4;
+			dst[i] = premultiply((div257(p[3]) << 24) | (div257(p[0]) << 16) | (div257(p[1]) << 8)
+				| div257(p[2]));
+		}
+	} break;
+	}
+}
+
+#ifdef DIRECT2D_CONVERT_X86
+// premultiplies 4 B8G8R8A8 pixels, alpha is kept as is
+DIRECT2D_TARGET_SSE4 static inline __m128i premultiplySse(__m128i pixels)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi16(0x80);
+	__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+	__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+	__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	lo = _mm_mullo_epi16(lo, alo);
+	hi = _mm_mullo_epi16(hi, ahi);
+	lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), half), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), half), 8);
+	const __m128i alphaMask = _mm_set1_epi32(int(0xff000000u));
+	return _mm_or_si128(_mm_andnot_si128(alphaMask, _mm_packus_epi16(lo, hi)),
+		_mm_and_si128(alphaMask, pixels));
+}
+
+// 16 bit channels of 2 pixels to 8 bit, v / 257 rounded
+DIRECT2D_TARGET_SSE4 static inline __m128i div257Sse(__m128i v)
+{
+	return _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(v, _mm_srli_epi16(v, 8)), _mm_set1_epi16(0x80)),
+		8);
+}
+
+DIRECT2D_TARGET_SSE4 static int convertSse(Direct2DPixelFormat format, const uint8_t* src, uint32_t* dst, int width)
+{
+	int i = 0;
+	switch (format) {
+	case Direct2DPixelFormat::ARGB32:
+		for (; i + 4 <= width; i += 4) {
+			const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + size_t(i) * 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), premultiplySse(p));
+		}
+		break;
+	case Direct2DPixelFormat::RGBX8888: {
+		const __m128i swap = _mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+		const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+		for (; i + 4 <= width; i += 4) {
+			const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + size_t(i) * 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+				_mm_or_si128(_mm_shuffle_epi8(p, swap), alpha));
+		}
+	} break;
+	case Direct2DPixelFormat::RGB888: {
+		const __m128i swap = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+		const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+		// a 16 byte load covers 5 pixels and a bit, stop while it stays inside the scanline
+		for (; i + 6 <= width; i += 4) {
+			const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + size_t(i) * 3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+				_mm_or_si128(_mm_shuffle_epi8(p, swap), alpha));
+		}
+	} break;
+	case Direct2DPixelFormat::Grayscale8: {
+		const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+		for (; i + 4 <= width; i += 4) {
+			int32_t packed;
+			std::memcpy(&packed, src + i, sizeof(packed));
+			const __m128i g = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+			const __m128i gray = _mm_or_si128(g, _mm_or_si128(_mm_slli_epi32(g, 8), _mm_slli_epi32(g, 16)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(gray, alpha));
+		}
+	} break;
+	case Direct2DPixelFormat::RGBA64: {
+		const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		for (; i + 4 <= width; i += 4) {
+			const __m128i* s = reinterpret_cast<const __m128i*>(src + size_t(i) * 8);
+			const __m128i a = div257Sse(_mm_loadu_si128(s));
+			const __m128i b = div257Sse(_mm_loadu_si128(s + 1));
+			const __m128i rgba = _mm_packus_epi16(a, b);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+				premultiplySse(_mm_shuffle_epi8(rgba, swap)));
+		}
+	} break;
+	}
+	return i;
+}
+
+// premultiplies 8 B8G8R8A8 pixels, unpack and pack stay within 128 bit lanes so order holds
+DIRECT2D_TARGET_AVX2 static inline __m256i premultiplyAvx2(__m256i pixels)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i half = _mm256_set1_epi16(0x80);
+	const __m256i alphaSpread = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+		6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+	__m256i lo = _mm256_unpacklo_epi8(pixels, zero);
+	__m256i hi = _mm256_unpackhi_epi8(pixels, zero);
+	lo = _mm256_mullo_epi16(lo, _mm256_shuffle_epi8(lo, alphaSpread));
+	hi = _mm256_mullo_epi16(hi, _mm256_shuffle_epi8(hi, alphaSpread));
+	lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), half), 8);
+	hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), half), 8);
+	const __m256i alphaMask = _mm256_set1_epi32(int(0xff000000u));
+	return _mm256_or_si256(_mm256_andnot_si256(alphaMask, _mm256_packus_epi16(lo, hi)),
+		_mm256_and_si256(alphaMask, pixels));
+}
+
+DIRECT2D_TARGET_AVX2 static int convertAvx2(Direct2DPixelFormat format, const uint8_t* src, uint32_t* dst, int width)
+{
+	int i = 0;
+	switch (format) {
+	case Direct2DPixelFormat::ARGB32:
+		for (; i + 8 <= width; i += 8) {
+			const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + size_t(i) * 4));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), premultiplyAvx2(p));
+		}
+		break;
+	case Direct2DPixelFormat::RGBX8888: {
+		const __m256i swap = _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+			2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+		const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+		for (; i + 8 <= width; i += 8) {
+			const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + size_t(i) * 4));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+				_mm256_or_si256(_mm256_shuffle_epi8(p, swap), alpha));
+		}
+	} break;
+	case Direct2DPixelFormat::Grayscale8: {
+		const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+		for (; i + 8 <= width; i += 8) {
+			const __m256i g = _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+			const __m256i gray = _mm256_or_si256(g,
+				_mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(g, 16)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(gray, alpha));
+		}
+	} break;
+	case Direct2DPixelFormat::RGB888:
+	case Direct2DPixelFormat::RGBA64:
+		// 3 byte pixels cross the 128 bit lanes, the SSE kernels do these
+		break;
+	}
+	return i;
+}
+#endif
+
+#ifdef DIRECT2D_CONVERT_NEON
+// c * a / 255 rounded like premultiplyChannel, on 8 lanes
+static inline uint8x8_t premultiplyNeon(uint8x8_t c, uint8x8_t a)
+{
+	const uint16x8_t x = vmull_u8(c, a);
+	return vshrn_n_u16(vaddq_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), vdupq_n_u16(0x80)), 8);
+}
+
+static inline uint8x8_t div257Neon(uint16x8_t v)
+{
+	return vshrn_n_u16(vaddq_u16(vsubq_u16(v, vshrq_n_u16(v, 8)), vdupq_n_u16(0x80)), 8);
+}
+
+static int convertNeon(Direct2DPixelFormat format, const uint8_t* src, uint32_t* dst, int width)
+{
+	int i = 0;
+	uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+	switch (format) {
+	case Direct2DPixelFormat::ARGB32:
+		for (; i + 8 <= width; i += 8) {
+			uint8x8x4_t p = vld4_u8(src + size_t(i) * 4);
+			p.val[0] = premultiplyNeon(p.val[0], p.val[3]);
+			p.val[1] = premultiplyNeon(p.val[1], p.val[3]);
+			p.val[2] = premultiplyNeon(p.val[2], p.val[3]);
+			vst4_u8(d + size_t(i) * 4, p);
+		}
+		break;
+	case Direct2DPixelFormat::RGBX8888:
+		for (; i + 8 <= width; i += 8) {
+			const uint8x8x4_t s = vld4_u8(src + size_t(i) * 4);
+			uint8x8x4_t p;
+			p.val[0] = s.val[2];
+			p.val[1] = s.val[1];
+			p.val[2] = s.val[0];
+			p.val[3] = vdup_n_u8(0xff);
+			vst4_u8(d + size_t(i) * 4, p);
+		}
+		break;
+	case Direct2DPixelFormat::RGB888:
+		for (; i + 8 <= width; i += 8) {
+			const uint8x8x3_t s = vld3_u8(src + size_t(i) * 3);
+			uint8x8x4_t p;
+			p.val[0] = s.val[2];
+			p.val[1] = s.val[1];
+			p.val[2] = s.val[0];
+			p.val[3] = vdup_n_u8(0xff);
+			vst4_u8(d + size_t(i) * 4, p);
+		}
+		break;
+	case Direct2DPixelFormat::Grayscale8:
+		for (; i + 8 <= width; i += 8) {
+			const uint8x8_t g = vld1_u8(src + i);
+			uint8x8x4_t p;
+			p.val[0] = g;
+			p.val[1] = g;
+			p.val[2] = g;
+			p.val[3] = vdup_n_u8(0xff);
+			vst4_u8(d + size_t(i) * 4, p);
+		}
+		break;
+	case Direct2DPixelFormat::RGBA64:
+		for (; i + 8 <= width; i += 8) {
+			const uint16x8x4_t s = vld4q_u16(reinterpret_cast<const uint16_t*>(src) + size_t(i) * 4);
+			const uint8x8_t a = div257Neon(s.val[3]);
+			uint8x8x4_t p;
+			p.val[0] = premultiplyNeon(div257Neon(s.val[2]), a);
+			p.val[1] = premultiplyNeon(div257Neon(s.val[1]), a);
+			p.val[2] = premultiplyNeon(div257Neon(s.val[0]), a);
+			p.val[3] = a;
+			vst4_u8(d + size_t(i) * 4, p);
+		}
+		break;
+	}
+	return i;
+}
+#endif
+
+void direct2dConvertScanlineScalar(Direct2DPixelFormat format,
+	const void* src,
+	uint32_t* dst,
+	int width)
+{
+	convertScalar(format, static_cast<const uint8_t*>(src), dst, 0, width);
+}
+
+void direct2dConvertScanline(Direct2DPixelFormat format, const void* src, uint32_t* dst, int width)
+{
+	const uint8_t* s = static_cast<const uint8_t*>(src);
+	const int level = activeIsa.load(std::memory_order_relaxed);
+	int done = 0;
+#if defined(DIRECT2D_CONVERT_X86)
+	if (level >= Avx2)
+		done = convertAvx2(format, s, dst, width);
+	// picks up the formats AVX2 leaves to it and the 4 pixel tail
+	if (level >= Sse4 && done < width) {
+		const size_t bytesPerPixel = format == Direct2DPixelFormat::RGB888 ? 3
+			: format == Direct2DPixelFormat::Grayscale8                   ? 1
+			: format == Direct2DPixelFormat::RGBA64                       ? 8
+																		  : 4;
+		done += convertSse(format, s + size_t(done) * bytesPerPixel, dst + done, width - done);
+	}
+#elif defined(DIRECT2D_CONVERT_NEON)
+	if (level == Neon)
+		done = convertNeon(format, s, dst, width);
+#endif
+	convertScalar(format, s, dst, done, width);
+}
+
+void direct2dConvertImage(Direct2DPixelFormat format,
+	const void* src,
+	size_t srcStride,
+	uint32_t* dst,
+	size_t dstStride,
+	int width,
+	int height)
+{
+	const uint8_t* s = static_cast<const uint8_t*>(src);
+	uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+	for (int y = 0; y < height; y++)
+		direct2dConvertScanline(format,
+			s + size_t(y) * srcStride,
+			reinterpret_cast<uint32_t*>(d + size_t(y) * dstStride),
+			width);
+}
+
+const char* direct2dPixelConvertIsa()
+{
+	return isaNames[activeIsa.load(std::memory_order_relaxed)];
+}
+
+bool direct2dSetPixelConvertIsa(const char* name)
+{
+	for (int level = Scalar; level <= Neon; level++) {
+		if (std::strcmp(name, isaNames[level]) != 0)
+			continue;
+		// NEON is not a level above the x86 ones
+		const bool supported = level == Scalar || level == supportedIsa
+			|| (supportedIsa != Neon && level <= supportedIsa);
+		if (!supported)
+			return false;
+		activeIsa.store(level, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
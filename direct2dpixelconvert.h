@@ -0,0 +1,115 @@
+#ifndef DIRECT2DPIXELCONVERT_H
+#define DIRECT2DPIXELCONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Scanline conversion of the common QImage formats straight into the B8G8R8A8 premultiplied
+// layout Direct2D bitmaps are created with. The kernels (AVX2, SSE4.1, NEON or scalar) are
+// picked at run time from what the CPU supports and only depend on the standard library, so
+// they can be checked against the scalar reference on any platform.
+
+// Source layouts, named after the QImage formats they come from.
+enum class Direct2DPixelFormat : int
+{
+	ARGB32,     // 0xAARRGGBB words, not premultiplied
+	RGBX8888,   // R, G, B, X bytes
+	RGB888,     // R, G, B bytes
+	Grayscale8, // one byte
+	RGBA64      // R, G, B, A 16 bit words, not premultiplied
+};
+
+// Converts width pixels of one scanline. src and dst must not overlap.
+void direct2dConvertScanline(Direct2DPixelFormat format, const void* src, uint32_t* dst, int width);
+// Reference implementation, the vector kernels produce the same bits.
+void direct2dConvertScanlineScalar(Direct2DPixelFormat format,
+	const void* src,
+	uint32_t* dst,
+	int width);
+// Converts a whole image, strides are in bytes.
+void direct2dConvertImage(Direct2DPixelFormat format,
+	const void* src,
+	size_t srcStride,
+	uint32_t* dst,
+	size_t dstStride,
+	int width,
+	int height);
+// "avx2", "sse4.1", "neon" or "scalar", the kernels in use
+const char* direct2dPixelConvertIsa();
+// Uses the kernels of isa, one of the names above, e.g. to compare them. False when the CPU
+// does not support it.
+bool direct2dSetPixelConvertIsa(const char* isa);
+
+// Reusable upload memory. acquire() hands out a buffer of at least the requested size and
+// release() takes it back, so steady state uploads do not allocate. Buffers larger than
+// maxBufferBytes are freed on release(): a one-off huge upload does not stay resident, uploads
+// of that size allocate every time. The default fits a 3840x2160 frame.
+class Direct2DStagingPool
+{
+private:
+	std::vector<std::vector<uint32_t>> m_free;
+	size_t m_maxBuffers;
+	size_t m_maxBufferBytes;
+
+public:
+	explicit Direct2DStagingPool(size_t maxBuffers = 2, size_t maxBufferBytes = 32 * 1024 * 1024)
+		: m_maxBuffers(maxBuffers)
+		, m_maxBufferBytes(maxBufferBytes)
+	{}
+
+	inline void setMaxBufferBytes(size_t bytes)
+	{
+		m_maxBufferBytes = bytes;
+		trim();
+	}
+	inline size_t maxBufferBytes() const { return m_maxBufferBytes; }
+
+	std::vector<uint32_t> acquire(size_t pixels)
+	{
+		std::vector<uint32_t> buffer;
+		// prefer the smallest free buffer that is already large enough
+		size_t best = m_free.size();
+		for (size_t i = 0; i < m_free.size(); i++) {
+			if (m_free[i].size() >= pixels
+				&& (best == m_free.size() || m_free[i].size() < m_free[best].size()))
+				best = i;
+		}
+		if (best == m_free.size() && !m_free.empty())
+			best = 0;
+		if (best < m_free.size()) {
+			buffer = std::move(m_free[best]);
+			m_free.erase(m_free.begin() + std::ptrdiff_t(best));
+		}
+		if (buffer.size() < pixels)
+			buffer.resize(pixels);
+		return buffer;
+	}
+
+	void release(std::vector<uint32_t>&& buffer)
+	{
+		if (m_free.size() < m_maxBuffers && buffer.capacity() * sizeof(uint32_t) <= m_maxBufferBytes)
+			m_free.push_back(std::move(buffer));
+	}
+
+	// frees the buffers over maxBufferBytes
+	void trim()
+	{
+		for (size_t i = m_free.size(); i-- > 0;) {
+			if (m_free[i].capacity() * sizeof(uint32_t) > m_maxBufferBytes)
+				m_free.erase(m_free.begin() + std::ptrdiff_t(i));
+		}
+	}
+
+	void clear() { m_free.clear(); }
+
+	size_t residentBytes() const
+	{
+		size_t bytes = 0;
+		for (const std::vector<uint32_t>& buffer : m_free)
+			bytes += buffer.capacity() * sizeof(uint32_t);
+		return bytes;
+	}
+};
+
+#endif // DIRECT2DPIXELCONVERT_H
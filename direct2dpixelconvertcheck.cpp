@@ -0,0 +1,147 @@
+// Checks every pixel conversion kernel the CPU supports against the scalar reference, times
+// them on a 1920x1080 frame and checks the staging pool limits. Only depends on the standard
+// library, build it with direct2dpixelconvert.cpp, e.g.
+//   g++ -std=c++17 -O2 direct2dpixelconvertcheck.cpp direct2dpixelconvert.cpp
+//   cl /std:c++17 /O2 /EHsc direct2dpixelconvertcheck.cpp direct2dpixelconvert.cpp
+// Exits with 0 when every width, alignment and format matches bit for bit.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "direct2dpixelconvert.h"
+
+static const Direct2DPixelFormat formats[] = { Direct2DPixelFormat::ARGB32,
+	Direct2DPixelFormat::RGBX8888,
+	Direct2DPixelFormat::RGB888,
+	Direct2DPixelFormat::Grayscale8,
+	Direct2DPixelFormat::RGBA64 };
+static const char* const formatNames[] = { "ARGB32", "RGBX8888", "RGB888", "Grayscale8", "RGBA64" };
+static const size_t bytesPerPixel[] = { 4, 4, 3, 1, 8 };
+static const char* const isas[] = { "scalar", "sse4.1", "avx2", "neon" };
+
+static int checkKernels()
+{
+	std::mt19937 random(0x2d2d);
+	int failures = 0;
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		for (int width = 0; width <= 67; width++) {
+			// misaligned sources too, the kernels use unaligned loads
+			for (size_t offset = 0; offset < 4; offset++) {
+				std::vector<uint8_t> src(offset + size_t(width) * bytesPerPixel[f]);
+				for (uint8_t& byte : src)
+					byte = uint8_t(random());
+				// alpha extremes are where rounding goes wrong
+				if (formats[f] == Direct2DPixelFormat::ARGB32) {
+					for (int i = 0; i < width; i += 3)
+						src[offset + size_t(i) * 4 + 3] = (i / 3) % 2 ? 0xff : 0x00;
+				}
+
+				std::vector<uint32_t> expected(size_t(width) + 1, 0xdeadbeef);
+				std::vector<uint32_t> actual(size_t(width) + 1, 0xdeadbeef);
+				direct2dConvertScanlineScalar(formats[f], src.data() + offset, expected.data(), width);
+				direct2dConvertScanline(formats[f], src.data() + offset, actual.data(), width);
+				if (actual != expected) {
+					size_t i = 0;
+					while (actual[i] == expected[i])
+						i++;
+					std::printf("%s: %s width %d offset %zu pixel %zu: %#010x, expected %#010x\n",
+						direct2dPixelConvertIsa(),
+						formatNames[f],
+						width,
+						offset,
+						i,
+						actual[i],
+						expected[i]);
+					failures++;
+				}
+			}
+		}
+	}
+
+	// every ARGB32 value of a channel against every alpha
+	std::vector<uint32_t> src(256 * 256);
+	for (uint32_t a = 0; a < 256; a++) {
+		for (uint32_t c = 0; c < 256; c++)
+			src[a * 256 + c] = (a << 24) | (c << 16) | ((255 - c) << 8) | (c ^ 0x5a);
+	}
+	std::vector<uint32_t> expected(src.size());
+	std::vector<uint32_t> actual(src.size());
+	direct2dConvertScanlineScalar(Direct2DPixelFormat::ARGB32, src.data(), expected.data(), int(src.size()));
+	direct2dConvertScanline(Direct2DPixelFormat::ARGB32, src.data(), actual.data(), int(src.size()));
+	if (actual != expected) {
+		std::printf("%s: ARGB32 exhaustive premultiply differs\n", direct2dPixelConvertIsa());
+		failures++;
+	}
+	return failures;
+}
+
+static int checkStagingPool()
+{
+	int failures = 0;
+	Direct2DStagingPool pool(2, 1024 * sizeof(uint32_t));
+
+	std::vector<uint32_t> small = pool.acquire(512);
+	const uint32_t* smallData = small.data();
+	pool.release(std::move(small));
+	if (pool.acquire(256).data() != smallData) {
+		std::printf("staging pool: a released buffer was not reused\n");
+		failures++;
+	}
+
+	pool.release(pool.acquire(4096));
+	if (pool.residentBytes() != 0) {
+		std::printf("staging pool: kept %zu bytes over the buffer cap\n", pool.residentBytes());
+		failures++;
+	}
+
+	pool.release(pool.acquire(1024));
+	pool.setMaxBufferBytes(512 * sizeof(uint32_t));
+	if (pool.residentBytes() != 0) {
+		std::printf("staging pool: lowering the cap kept %zu bytes\n", pool.residentBytes());
+		failures++;
+	}
+	return failures;
+}
+
+// milliseconds per 1920x1080 frame of every format with the kernels in use
+static void timeKernels()
+{
+	const int width = 1920;
+	const int height = 1080;
+	const int frames = 20;
+	std::mt19937 random(0x2d2d);
+	std::vector<uint32_t> dst(size_t(width) * height);
+	std::printf("%-8s", direct2dPixelConvertIsa());
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		std::vector<uint8_t> src(size_t(width) * height * bytesPerPixel[f]);
+		for (uint8_t& byte : src)
+			byte = uint8_t(random());
+		const size_t stride = size_t(width) * bytesPerPixel[f];
+		// one untimed frame to fault the pages in
+		direct2dConvertImage(formats[f], src.data(), stride, dst.data(), width * 4, width, height);
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++)
+			direct2dConvertImage(formats[f], src.data(), stride, dst.data(), width * 4, width, height);
+		const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		std::printf("  %s %.3f ms", formatNames[f], elapsed.count() / frames);
+	}
+	std::printf("\n");
+}
+
+int main()
+{
+	int failures = checkStagingPool();
+	for (const char* isa : isas) {
+		if (!direct2dSetPixelConvertIsa(isa))
+			continue;
+		const int kernelFailures = checkKernels();
+		std::printf("%s: %s\n", isa, kernelFailures ? "FAILED" : "ok");
+		failures += kernelFailures;
+	}
+	for (const char* isa : isas) {
+		if (direct2dSetPixelConvertIsa(isa))
+			timeKernels();
+	}
+	return failures ? 1 : 0;
+}
@@ -2,9 +2,11 @@
 #define DIRECT2DQTHELPER_H
 
 #include "qcolor.h"
+#include "qimage.h"
 #include "qpoint.h"
 #include "qtransform.h"
 #include <d2d1_1helper.h>
+#include "src/direct2d/direct2dpixelconvert.h"
 
 inline D2D1::ColorF toD2DColorF(const QColor& c)
 {
@@ -17,6 +19,11 @@ inline D2D1_POINT_2F tod2dPoint2f(const QPointF& qpoint)
 	return D2D1::Point2F(qpoint.x(), qpoint.y());
 }
 
+inline D2D1_POINT_2F tod2dPoint2f(const QPoint& qpoint)
+{
+	return D2D1::Point2F(FLOAT(qpoint.x()), FLOAT(qpoint.y()));
+}
+
 inline D2D1_MATRIX_3X2_F toD2dMatrix3x2F(const QTransform& transform)
 {
 	return D2D1::Matrix3x2F(transform.m11(), transform.m12(),
@@ -34,6 +41,30 @@ inline D2D1_RECT_F toD2dRectF(const FLOAT x, const FLOAT y, const FLOAT width, c
 	return D2D1::RectF(x, y, x + width, y + height);
 }
 
+// QImage formats direct2dConvertScanline turns into B8G8R8A8 premultiplied
+inline bool toDirect2DPixelFormat(QImage::Format format, Direct2DPixelFormat* result)
+{
+	switch (format) {
+	case QImage::Format_ARGB32:
+		*result = Direct2DPixelFormat::ARGB32;
+		return true;
+	case QImage::Format_RGBX8888:
+		*result = Direct2DPixelFormat::RGBX8888;
+		return true;
+	case QImage::Format_RGB888:
+		*result = Direct2DPixelFormat::RGB888;
+		return true;
+	case QImage::Format_Grayscale8:
+		*result = Direct2DPixelFormat::Grayscale8;
+		return true;
+	case QImage::Format_RGBA64:
+		*result = Direct2DPixelFormat::RGBA64;
+		return true;
+	default:
+		return false;
+	}
+}
+
 template<class Interface>
 inline void
 SafeRelease(Interface** ppInterfaceToRelease)
@@ -0,0 +1,175 @@
+#ifndef DIRECT2DSURFACEPOOL_H
+#define DIRECT2DSURFACEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Counters of a Direct2DSurfacePool. Bytes are estimated from the allocated (bucketed) sizes.
+struct Direct2DSurfacePoolStats
+{
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+	std::uint64_t trimmed = 0;
+	size_t pooledBytes = 0;
+	size_t pooledCount = 0;
+	size_t maxBytes = 0;
+
+	inline double hitRate() const
+	{
+		const std::uint64_t lookups = hits + misses;
+		return lookups ? double(hits) / double(lookups) : 0.0;
+	}
+};
+
+// Free list of offscreen surfaces grouped by format and size bucket. Sizes are rounded up to
+// the bucket grid, so a surface that is resized by a few pixels keeps fitting its allocation
+// and only its viewport changes. Like Direct2DLruCache it knows nothing about Direct2D:
+// Surface is any movable handle and Format any equality comparable description of it.
+template<class Surface, class Format>
+class Direct2DSurfacePool
+{
+private:
+	struct entry
+	{
+		Surface surface;
+		Format format;
+		std::uint32_t width;
+		std::uint32_t height;
+		std::uint64_t releasedAt;
+	};
+
+	// oldest release first
+	std::vector<entry> m_free;
+	size_t m_maxBytes;
+	size_t m_bytesPerPixel;
+	std::uint64_t m_tick;
+	Direct2DSurfacePoolStats m_stats;
+	mutable std::mutex m_mutex;
+
+	size_t bytes(const entry& e) const { return size_t(e.width) * e.height * m_bytesPerPixel; }
+
+	void trimLocked(size_t budget)
+	{
+		while (m_stats.pooledBytes > budget && !m_free.empty()) {
+			m_stats.pooledBytes -= bytes(m_free.front());
+			m_free.erase(m_free.begin());
+			++m_stats.trimmed;
+		}
+		m_stats.pooledCount = m_free.size();
+	}
+
+public:
+	explicit Direct2DSurfacePool(size_t maxBytes, size_t bytesPerPixel = 4)
+		: m_maxBytes(maxBytes)
+		, m_bytesPerPixel(bytesPerPixel)
+		, m_tick(0)
+	{
+		m_stats.maxBytes = maxBytes;
+	}
+
+	// Rounds an edge up to the bucket grid: 64 px steps up to 1024, then 256 px steps.
+	static std::uint32_t bucket(std::uint32_t size)
+	{
+		if (size == 0)
+			return 64;
+		const std::uint32_t step = size <= 1024 ? 64 : 256;
+		return (size + step - 1) / step * step;
+	}
+
+	// Returns a pooled surface of the bucket of width x height, or nothing if the caller has
+	// to allocate one of bucket(width) x bucket(height).
+	std::optional<Surface> acquire(const Format& format, std::uint32_t width, std::uint32_t height)
+	{
+		const std::uint32_t w = bucket(width);
+		const std::uint32_t h = bucket(height);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// most recently released first, it is the most likely to still be resident
+		for (size_t i = m_free.size(); i-- > 0;) {
+			entry& e = m_free[i];
+			if (e.width == w && e.height == h && e.format == format) {
+				Surface surface = std::move(e.surface);
+				m_stats.pooledBytes -= bytes(e);
+				m_free.erase(m_free.begin() + std::ptrdiff_t(i));
+				m_stats.pooledCount = m_free.size();
+				++m_stats.hits;
+				return surface;
+			}
+		}
+		++m_stats.misses;
+		return std::nullopt;
+	}
+
+	// Takes back a surface of allocated size width x height, trimming the oldest surfaces
+	// when the pool goes over budget.
+	void release(Surface&& surface, const Format& format, std::uint32_t width, std::uint32_t height)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry e{ std::move(surface), format, width, height, ++m_tick };
+		const size_t size = bytes(e);
+		if (size > m_maxBytes)
+			return;
+		m_free.push_back(std::move(e));
+		m_stats.pooledBytes += size;
+		trimLocked(m_maxBytes);
+	}
+
+	// Drops pooled surfaces until at most budget bytes are left, oldest first.
+	void trim(size_t budget = 0)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		trimLocked(budget);
+	}
+
+	// Drops surfaces that were not reused within the last releases releases.
+	void trimOlderThan(std::uint64_t releases)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t kept = 0;
+		for (size_t i = 0; i < m_free.size(); i++) {
+			if (m_tick - m_free[i].releasedAt < releases) {
+				m_free[kept++] = std::move(m_free[i]);
+				continue;
+			}
+			m_stats.pooledBytes -= bytes(m_free[i]);
+			++m_stats.trimmed;
+		}
+		m_free.erase(m_free.begin() + std::ptrdiff_t(kept), m_free.end());
+		m_stats.pooledCount = kept;
+	}
+
+	void clear() { trim(0); }
+
+	void setMaxBytes(size_t maxBytes)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_maxBytes = maxBytes;
+		m_stats.maxBytes = maxBytes;
+		trimLocked(m_maxBytes);
+	}
+
+	size_t pooledBytes() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats.pooledBytes;
+	}
+
+	Direct2DSurfacePoolStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void resetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.hits = 0;
+		m_stats.misses = 0;
+		m_stats.trimmed = 0;
+	}
+};
+
+#endif // DIRECT2DSURFACEPOOL_H
@@ -0,0 +1,137 @@
+#include "direct2dswapchain.h"
+#include "directcontext.h"
+#include "qlogging.h"
+
+Direct2DSwapChain::Direct2DSwapChain()
+	: m_frameLatencyWaitable(nullptr)
+	, m_flags(0)
+	, m_bufferCount(0)
+	, m_tearing(false)
+{}
+
+Direct2DSwapChain::~Direct2DSwapChain()
+{
+	reset();
+}
+
+void Direct2DSwapChain::reset()
+{
+	if (m_frameLatencyWaitable) {
+		CloseHandle(m_frameLatencyWaitable);
+		m_frameLatencyWaitable = nullptr;
+	}
+	m_swapChain.Reset();
+}
+
+bool Direct2DSwapChain::create(HWND hwnd, const Direct2DPresentOptions& options)
+{
+	// a window can only hold one flip model swap chain at a time, and the old one is only gone
+	// once the immediate context no longer references its buffers
+	const bool replacing = m_swapChain != nullptr;
+	reset();
+	if (replacing) {
+		ID3D11DeviceContext3* context = DirectContext::instance().d3dDeviceContext();
+		context->ClearState();
+		context->Flush();
+	}
+	m_options = options;
+
+	const bool flip = options.swapEffect != Direct2DPresentOptions::Sequential;
+	DXGI_SWAP_CHAIN_DESC1 desc = {};
+
+	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	desc.SampleDesc.Count = 1;
+	desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	switch (options.swapEffect) {
+	case Direct2DPresentOptions::FlipSequential:
+		desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+		break;
+	case Direct2DPresentOptions::FlipDiscard:
+		desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+		break;
+	case Direct2DPresentOptions::Sequential:
+	default:
+		desc.SwapEffect = DXGI_SWAP_EFFECT_SEQUENTIAL;
+		break;
+	}
+	desc.BufferCount = flip ? qBound(2u, options.bufferCount, 3u) : 1;
+	m_bufferCount = desc.BufferCount;
+
+	m_flags = 0;
+	if (flip && options.frameLatencyWaitable)
+		m_flags |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
+	m_tearing = false;
+	if (flip && options.allowTearing) {
+		BOOL supported = FALSE;
+		if (SUCCEEDED(DirectContext::instance().dxgiFactory()->CheckFeatureSupport(
+				DXGI_FEATURE_PRESENT_ALLOW_TEARING, &supported, sizeof(supported)))
+			&& supported) {
+			m_tearing = true;
+			m_flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+		}
+	}
+	desc.Flags = m_flags;
+
+	HRESULT hr = DirectContext::instance().dxgiFactory()->CreateSwapChainForHwnd(
+		DirectContext::instance().d3dDevice(), // [in]   IUnknown *pDevice
+		hwnd,                                  // [in]   HWND hWnd
+		&desc,                                 // [in]   const DXGI_SWAP_CHAIN_DESC1 *pDesc
+		nullptr, // [in]   const DXGI_SWAP_CHAIN_FULLSCREEN_DESC *pFullscreenDesc
+		nullptr, // [in]   IDXGIOutput *pRestrictToOutput
+		m_swapChain.ReleaseAndGetAddressOf()); // [out]  IDXGISwapChain1 **ppSwapChain
+
+	if (FAILED(hr)) {
+		qWarning("%s: Could not create swap chain: %#lx", __FUNCTION__, hr);
+		return false;
+	}
+
+	if (m_flags & DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT) {
+		ComPtr<IDXGISwapChain2> swapChain2;
+		hr = m_swapChain.As(&swapChain2);
+		if (SUCCEEDED(hr)) {
+			swapChain2->SetMaximumFrameLatency(qMax(1u, options.maximumFrameLatency));
+			m_frameLatencyWaitable = swapChain2->GetFrameLatencyWaitableObject();
+		}
+		else {
+			qWarning("%s: IDXGISwapChain2 not available: %#lx", __FUNCTION__, hr);
+		}
+	}
+	return true;
+}
+
+HRESULT Direct2DSwapChain::resize(const QSize& size)
+{
+	if (!m_swapChain)
+		return DXGI_ERROR_INVALID_CALL;
+	return m_swapChain->ResizeBuffers(0,
+		UINT(size.width()),
+		UINT(size.height()),
+		DXGI_FORMAT_UNKNOWN,
+		m_flags);
+}
+
+void Direct2DSwapChain::waitForNextFrame(DWORD timeoutMs)
+{
+	if (m_frameLatencyWaitable)
+		WaitForSingleObjectEx(m_frameLatencyWaitable, timeoutMs, TRUE);
+}
+
+HRESULT Direct2DSwapChain::present(const QRect* dirtyRect)
+{
+	if (!m_swapChain)
+		return DXGI_ERROR_INVALID_CALL;
+
+	UINT flags = 0;
+	if (m_tearing && m_options.syncInterval == 0)
+		flags |= DXGI_PRESENT_ALLOW_TEARING;
+
+	DXGI_PRESENT_PARAMETERS parameters = {};
+	RECT rect;
+	if (dirtyRect && supportsPartialPresent()) {
+		rect = { dirtyRect->left(), dirtyRect->top(), dirtyRect->right() + 1, dirtyRect->bottom() + 1 };
+		parameters.DirtyRectsCount = 1;
+		parameters.pDirtyRects = &rect;
+	}
+	return m_swapChain->Present1(m_options.syncInterval, flags, &parameters);
+}
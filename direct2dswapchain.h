@@ -0,0 +1,66 @@
+#ifndef DIRECT2DSWAPCHAIN_H
+#define DIRECT2DSWAPCHAIN_H
+
+#include <QRect>
+#include <dxgi1_6.h>
+#include <windows.h>
+#include <wrl.h>
+
+using Microsoft::WRL::ComPtr;
+
+struct Direct2DPresentOptions
+{
+	enum SwapEffect
+	{
+		Sequential, // single buffered blt model, what the widgets always used
+		FlipSequential,
+		FlipDiscard
+	};
+
+	SwapEffect swapEffect = FlipSequential;
+	// flip model chains need 2 or 3 buffers, blt model ones use 1
+	UINT bufferCount = 2;
+	// frames that may be queued before waitForNextFrame() blocks
+	UINT maximumFrameLatency = 1;
+	bool frameLatencyWaitable = true;
+	// only honored for flip model chains with syncInterval 0 on systems that support it
+	bool allowTearing = false;
+	UINT syncInterval = 1;
+};
+
+// Swap chain shared by Direct2DWindow and Direct2DWidget, remembers the creation flags
+// ResizeBuffers has to repeat and owns the frame latency waitable object.
+class Direct2DSwapChain
+{
+private:
+	ComPtr<IDXGISwapChain1> m_swapChain;
+	HANDLE m_frameLatencyWaitable;
+	Direct2DPresentOptions m_options;
+	UINT m_flags;
+	UINT m_bufferCount;
+	bool m_tearing;
+
+public:
+	Direct2DSwapChain();
+	~Direct2DSwapChain();
+
+	bool create(HWND hwnd, const Direct2DPresentOptions& options);
+	void reset();
+	HRESULT resize(const QSize& size);
+	// Blocks until the compositor is ready for a new frame, call right before rendering.
+	void waitForNextFrame(DWORD timeoutMs = 1000);
+	HRESULT present(const QRect* dirtyRect = nullptr);
+
+	// DXGI_SWAP_EFFECT_FLIP_DISCARD leaves the back buffer undefined after a present
+	inline bool supportsPartialPresent() const
+	{
+		return m_options.swapEffect != Direct2DPresentOptions::FlipDiscard;
+	}
+	// buffers actually created, a back buffer last held the frame presented this many frames ago
+	inline UINT bufferCount() const { return m_bufferCount; }
+	inline const Direct2DPresentOptions& options() const { return m_options; }
+	inline IDXGISwapChain1* get() const { return m_swapChain.Get(); }
+	inline explicit operator bool() const { return m_swapChain != nullptr; }
+};
+
+#endif // DIRECT2DSWAPCHAIN_H
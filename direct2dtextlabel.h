@@ -0,0 +1,18 @@
+#ifndef DIRECT2DTEXTLABEL_H
+#define DIRECT2DTEXTLABEL_H
+
+#include <QColor>
+#include <QFont>
+#include <QPointF>
+#include <QString>
+
+// A single line of text drawn at its baseline origin, the unit of Direct2DPaintEngine::drawTextRuns.
+struct Direct2DTextLabel
+{
+	QPointF position;
+	QString text;
+	QFont font;
+	QColor color;
+};
+
+#endif // DIRECT2DTEXTLABEL_H
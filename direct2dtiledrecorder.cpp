@@ -0,0 +1,70 @@
+#include "direct2dtiledrecorder.h"
+
+Direct2DTiledRecorder::Direct2DTiledRecorder()
+	: m_tileSize(256, 256)
+{}
+
+Direct2DTiledRecorder::~Direct2DTiledRecorder()
+{
+	m_pool.waitForDone();
+}
+
+std::vector<QRect> Direct2DTiledRecorder::partition(const QSize& size, const QSize& tileSize)
+{
+	std::vector<QRect> tiles;
+	if (size.isEmpty() || tileSize.isEmpty())
+		return tiles;
+
+	const int columns = (size.width() + tileSize.width() - 1) / tileSize.width();
+	const int rows = (size.height() + tileSize.height() - 1) / tileSize.height();
+	tiles.reserve(size_t(columns) * size_t(rows));
+	for (int y = 0; y < size.height(); y += tileSize.height()) {
+		for (int x = 0; x < size.width(); x += tileSize.width()) {
+			tiles.emplace_back(x,
+				y,
+				qMin(tileSize.width(), size.width() - x),
+				qMin(tileSize.height(), size.height() - y));
+		}
+	}
+	return tiles;
+}
+
+void Direct2DTiledRecorder::setThreadCount(int threads)
+{
+	m_pool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+}
+
+void Direct2DTiledRecorder::record(const QSize& size, const PaintFunction& paint)
+{
+	m_tiles = partition(size, m_tileSize);
+	while (m_devices.size() < m_tiles.size())
+		m_devices.push_back(std::make_unique<Direct2DRecordingDevice>(size));
+
+	for (size_t i = 0; i < m_tiles.size(); ++i) {
+		Direct2DRecordingDevice* device = m_devices[i].get();
+		device->setSize(size);
+		device->commands().clear();
+
+		const QRect tile = m_tiles[i];
+		// the tile clip stays out of the recording, a recorded clip would replace the clip of
+		// the presenting painter
+		m_pool.start([device, tile, &paint]() {
+			QPainter painter(device);
+			paint(painter, tile);
+		});
+	}
+	m_pool.waitForDone();
+}
+
+void Direct2DTiledRecorder::replay(QPainter& painter) const
+{
+	for (size_t i = 0; i < m_tiles.size(); ++i) {
+		const Direct2DCommandBuffer& commands = m_devices[i]->commands();
+		if (commands.isEmpty())
+			continue;
+		painter.save();
+		painter.setClipRect(m_tiles[i], Qt::IntersectClip);
+		commands.replay(painter);
+		painter.restore();
+	}
+}
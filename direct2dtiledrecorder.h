@@ -0,0 +1,55 @@
+#ifndef DIRECT2DTILEDRECORDER_H
+#define DIRECT2DTILEDRECORDER_H
+
+#include <QRect>
+#include <QThreadPool>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "src/direct2d/direct2dcommandbuffer.h"
+
+// Splits a surface into tiles and records each tile on a worker thread into its own
+// Direct2DCommandBuffer, then replays the tiles in order on the presenting painter.
+// Recording only touches QtGui, the device context is used by replay alone, so the
+// paint function may run concurrently as long as it only reads shared scene data.
+class Direct2DTiledRecorder
+{
+public:
+	// Called once per tile on a worker thread. Replay clips every tile to its rect, skipping
+	// primitives outside of it is what makes the split pay off. The recording painter starts
+	// unclipped with an identity transform, replay composes both with the presenting painter.
+	using PaintFunction = std::function<void(QPainter& painter, const QRect& tile)>;
+
+private:
+	QThreadPool m_pool;
+	QSize m_tileSize;
+	std::vector<QRect> m_tiles;
+	// reused from one frame to the next so steady state recording does not allocate
+	std::vector<std::unique_ptr<Direct2DRecordingDevice>> m_devices;
+
+public:
+	Direct2DTiledRecorder();
+	~Direct2DTiledRecorder();
+
+	// Row-major tiles covering size, the last row and column are cut to the surface.
+	static std::vector<QRect> partition(const QSize& size, const QSize& tileSize);
+
+	void setThreadCount(int threads);
+	inline int threadCount() const { return m_pool.maxThreadCount(); }
+	inline void setTileSize(const QSize& tileSize) { m_tileSize = tileSize; }
+	inline QSize tileSize() const { return m_tileSize; }
+
+	// Blocks until every tile has been recorded.
+	void record(const QSize& size, const PaintFunction& paint);
+	// Replays the recorded tiles in partition order, each clipped to its tile in the painter's
+	// current coordinates and within its current clip.
+	void replay(QPainter& painter) const;
+
+	inline const std::vector<QRect>& tiles() const { return m_tiles; }
+	inline const Direct2DCommandBuffer& tileCommands(size_t tile) const
+	{
+		return m_devices[tile]->commands();
+	}
+};
+
+#endif // DIRECT2DTILEDRECORDER_H
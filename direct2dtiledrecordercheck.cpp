@@ -0,0 +1,155 @@
+// Checks the tile partition and that recording tile by tile and replaying in partition order
+// paints the same pixels as painting directly, on any thread count and under the transform and
+// clip of the presenting painter. Only depends on QtGui and draws no text, build it with
+// direct2dtiledrecorder.cpp and direct2dcommandbuffer.cpp and run it anywhere.
+// Exits with 0 when every check passes.
+#include <QImage>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <QThread>
+#include <cstdio>
+#include <vector>
+#include "src/direct2d/direct2dtiledrecorder.h"
+
+static int checkPartition()
+{
+	int failures = 0;
+	const QSize sizes[] = { QSize(1, 1), QSize(255, 256), QSize(257, 513), QSize(1024, 768) };
+	const QSize tileSizes[] = { QSize(256, 256), QSize(100, 37), QSize(1, 1024) };
+	for (const QSize& size : sizes) {
+		for (const QSize& tileSize : tileSizes) {
+			const std::vector<QRect> tiles = Direct2DTiledRecorder::partition(size, tileSize);
+			// every pixel in exactly one tile, tiles in row-major order
+			std::vector<int> covered(size_t(size.width()) * size_t(size.height()), 0);
+			for (size_t i = 0; i < tiles.size(); ++i) {
+				const QRect& tile = tiles[i];
+				if (i > 0
+					&& (tile.y() < tiles[i - 1].y()
+						|| (tile.y() == tiles[i - 1].y() && tile.x() <= tiles[i - 1].x()))) {
+					std::printf("partition %dx%d / %dx%d: tile %zu out of order\n",
+						size.width(),
+						size.height(),
+						tileSize.width(),
+						tileSize.height(),
+						i);
+					failures++;
+				}
+				for (int y = tile.top(); y <= tile.bottom(); ++y) {
+					for (int x = tile.left(); x <= tile.right(); ++x) {
+						if (x >= size.width() || y >= size.height())
+							continue;
+						++covered[size_t(y) * size_t(size.width()) + size_t(x)];
+					}
+				}
+				if (!QRect(QPoint(0, 0), size).contains(tile)) {
+					std::printf("partition %dx%d: tile %zu leaves the surface\n",
+						size.width(),
+						size.height(),
+						i);
+					failures++;
+				}
+			}
+			for (int count : covered) {
+				if (count != 1) {
+					std::printf("partition %dx%d / %dx%d: a pixel is in %d tiles\n",
+						size.width(),
+						size.height(),
+						tileSize.width(),
+						tileSize.height(),
+						count);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+	if (!Direct2DTiledRecorder::partition(QSize(0, 10), QSize(256, 256)).empty()) {
+		std::printf("partition of an empty size is not empty\n");
+		failures++;
+	}
+	return failures;
+}
+
+// translucent, overlapping and crossing tile edges, so a wrong merge order changes pixels
+static void paintScene(QPainter& painter, const QSize& size)
+{
+	QRandomGenerator random(0x2d2d);
+	painter.setPen(Qt::NoPen);
+	for (int i = 0; i < 2000; ++i) {
+		painter.setBrush(QColor::fromRgb(random.generate() & 0x7fffffff));
+		painter.drawRect(QRectF(random.bounded(size.width()), random.bounded(size.height()),
+			4 + random.bounded(120), 4 + random.bounded(120)));
+	}
+	painter.save();
+	painter.translate(30, 20);
+	painter.setPen(QPen(Qt::black, 3));
+	painter.drawLine(QPointF(0, 0), QPointF(size.width(), size.height()));
+	painter.restore();
+}
+
+static QImage blankImage(const QSize& size)
+{
+	QImage image(size, QImage::Format_ARGB32_Premultiplied);
+	image.fill(Qt::white);
+	return image;
+}
+
+static int checkReplay()
+{
+	int failures = 0;
+	const QSize size(700, 530);
+	const QTransform base = QTransform::fromTranslate(7, 5);
+	const QRect baseClip(40, 30, 600, 400);
+
+	QImage expected = blankImage(size);
+	{
+		QPainter painter(&expected);
+		painter.setTransform(base);
+		painter.setClipRect(baseClip);
+		paintScene(painter, size);
+	}
+
+	for (int threads = 1; threads <= qMax(4, QThread::idealThreadCount()); threads *= 2) {
+		Direct2DTiledRecorder recorder;
+		recorder.setThreadCount(threads);
+		recorder.setTileSize(QSize(128, 96));
+		recorder.record(size, [&size](QPainter& painter, const QRect&) { paintScene(painter, size); });
+
+		QImage actual = blankImage(size);
+		QPainter painter(&actual);
+		painter.setTransform(base);
+		painter.setClipRect(baseClip);
+		recorder.replay(painter);
+		painter.end();
+		if (actual != expected) {
+			std::printf("replay on %d threads differs from direct painting\n", threads);
+			failures++;
+		}
+	}
+
+	// a recorded ReplaceClip must stay inside the presenting painter's clip
+	Direct2DTiledRecorder recorder;
+	recorder.record(size, [&size](QPainter& painter, const QRect&) {
+		painter.setClipRect(QRect(QPoint(0, 0), size));
+		painter.fillRect(QRect(QPoint(0, 0), size), Qt::red);
+	});
+	QImage clipped = blankImage(size);
+	{
+		QPainter painter(&clipped);
+		painter.setClipRect(baseClip);
+		recorder.replay(painter);
+	}
+	if (clipped.pixel(baseClip.left() - 1, baseClip.top()) != qRgb(255, 255, 255)
+		|| clipped.pixel(baseClip.center()) != qRgb(255, 0, 0)) {
+		std::printf("a recorded clip replaced the presenting painter's clip\n");
+		failures++;
+	}
+	return failures;
+}
+
+int main()
+{
+	const int failures = checkPartition() + checkReplay();
+	std::printf("tiled recorder: %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
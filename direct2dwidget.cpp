@@ -13,8 +13,9 @@ Direct2DWidget::Direct2DWidget(QWidget* parent)
 	engine.reset();
 	m_hwnd = reinterpret_cast<HWND>(winId());
 	m_context = nullptr;
-	m_swapChain = nullptr;
 	m_deviceInitialized = false;
+	m_fullRepaintsPending = 1;
+	m_dirtyAreaRatio = 1.0;
 	setAttribute(Qt::WA_NoSystemBackground);
 	setAutoFillBackground(true);
 	setAttribute(Qt::WA_PaintOnScreen);
@@ -64,16 +65,12 @@ void Direct2DWidget::resizeSwapChain(const QSize& size)
 			return;
 
 
-		HRESULT hr = m_swapChain->ResizeBuffers(0,
-			UINT(size.width()),
-			UINT(size.height()),
-			DXGI_FORMAT_UNKNOWN,
-			0);
+		HRESULT hr = m_swapChain.resize(size);
 		if (FAILED(hr))
 			qWarning("%s: Could not resize swap chain: %#lx", __FUNCTION__, hr);
 
 		ComPtr<IDXGISurface1> backBufferSurface;
-		hr = m_swapChain->GetBuffer(0, IID_PPV_ARGS(&backBufferSurface));
+		hr = m_swapChain.get()->GetBuffer(0, IID_PPV_ARGS(&backBufferSurface));
 		if (FAILED(hr)) {
 			qWarning("%s: Could not query backbuffer for DXGI Surface: %#lx", __FUNCTION__, hr);
 			return;
@@ -89,6 +86,7 @@ void Direct2DWidget::resizeSwapChain(const QSize& size)
 			return;
 		}
 		m_context->SetTarget(backBufferBitmap.Get());
+		invalidateBuffers();
 	}
 }
 
@@ -97,9 +95,17 @@ void Direct2DWidget::flush()
 	m_context->Flush();
 }
 
+void Direct2DWidget::paintTiled(QPainter& painter, const Direct2DTiledRecorder::PaintFunction& paint)
+{
+	m_tiledRecorder.record(size(), paint);
+	m_tiledRecorder.replay(painter);
+}
+
 void Direct2DWidget::recreateTarget()
 {
 	if (m_deviceInitialized) {
+		// a window holds a single flip model chain, drop the old buffers first
+		m_context->SetTarget(nullptr);
 		setupSwapChain();
 		HRESULT hr = DirectContext::instance()
 			.d2dDevice()
@@ -120,15 +126,87 @@ void Direct2DWidget::recreateTarget()
 
 void Direct2DWidget::present()
 {
-	std::ignore = m_swapChain->Present(0, 0);
+	std::ignore = m_swapChain.present();
+}
+
+void Direct2DWidget::present(const QRect& dirtyRect)
+{
+	std::ignore = m_swapChain.present(&dirtyRect);
+}
+
+void Direct2DWidget::setPresentOptions(const Direct2DPresentOptions& options)
+{
+	m_presentOptions = options;
+	if (!m_deviceInitialized)
+		return;
+
+	// the old chain's buffers have to be released before the window gets a new one
+	m_context->SetTarget(nullptr);
+	if (!setupSwapChain())
+		return;
+	const qreal dpr = devicePixelRatioF();
+	resizeSwapChain(QSize(qRound(width() * dpr), qRound(height() * dpr)));
+	update();
 }
 
 bool Direct2DWidget::event(QEvent* event)
 {
 	if (event->type() == QEvent::Paint) {
-		if (m_deviceInitialized) {
-			bool result = QWidget::event(event);
-			present();
+		if (m_deviceInitialized && m_swapChain) {
+			const D2D1_SIZE_U pixelSize = m_context->GetPixelSize();
+			const QRect bufferRect(0, 0, int(pixelSize.width), int(pixelSize.height));
+			const QRectF region(static_cast<QPaintEvent*>(event)->region().boundingRect());
+			const qreal dpr = devicePixelRatioF();
+			const QRect dirty = QRectF(region.topLeft() * dpr, region.size() * dpr).toAlignedRect()
+				& bufferRect;
+
+			// The back buffer about to be drawn was presented bufferCount() frames ago, the
+			// rects painted since then have to be repainted into it as well.
+			QRect repaint = dirty;
+			for (const QRect& previous : m_dirtyHistory)
+				repaint |= previous;
+			repaint &= bufferRect;
+
+			// partial frames are clipped by the engine and presented with a dirty rect
+			const bool partial = m_fullRepaintsPending == 0 && m_swapChain.supportsPartialPresent()
+				&& !repaint.isEmpty() && repaint != bufferRect;
+			if (partial) {
+				m_updateRect = toD2dRectF(QRectF(repaint));
+				m_hasUpdateRect = true;
+			}
+			m_swapChain.waitForNextFrame();
+			// widgets that only paint event->rect() have to see the area the back buffer missed
+			bool result;
+			if (partial && repaint == dirty) {
+				result = QWidget::event(event);
+			}
+			else {
+				const QRect logical = partial
+					? QRectF(QPointF(repaint.topLeft()) / dpr, QSizeF(repaint.size()) / dpr)
+						  .toAlignedRect()
+					: rect();
+				QPaintEvent repaintEvent(logical);
+				result = QWidget::event(&repaintEvent);
+			}
+			m_hasUpdateRect = false;
+
+			if (partial) {
+				present(repaint);
+				m_dirtyAreaRatio = qreal(repaint.width()) * repaint.height()
+					/ (qreal(bufferRect.width()) * bufferRect.height());
+			}
+			else {
+				present();
+				m_fullRepaintsPending = qMax(0, m_fullRepaintsPending - 1);
+				m_dirtyAreaRatio = 1.0;
+			}
+
+			const size_t historySize = size_t(qMax(1u, m_swapChain.bufferCount()) - 1);
+			if (historySize > 0) {
+				m_dirtyHistory.push_back(partial ? dirty : bufferRect);
+				if (m_dirtyHistory.size() > historySize)
+					m_dirtyHistory.erase(m_dirtyHistory.begin());
+			}
 			return result;
 		}
 		qWarning("%s: HwndRenderTarget not initialized!", __FUNCTION__);
@@ -142,28 +220,18 @@ bool Direct2DWidget::nativeEvent(const QByteArray& eventType, void* message, qin
 	return QWidget::nativeEvent(eventType, message, result);
 }
 
-void Direct2DWidget::setupSwapChain()
+bool Direct2DWidget::setupSwapChain()
 {
-	DXGI_SWAP_CHAIN_DESC1 desc = {};
-
-	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-	desc.SampleDesc.Count = 1;
-	desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	desc.BufferCount = 1;
-	desc.SwapEffect = DXGI_SWAP_EFFECT_SEQUENTIAL;
-
-	HRESULT hr = DirectContext::instance().dxgiFactory()->CreateSwapChainForHwnd(
-		DirectContext::instance().d3dDevice(), // [in]   IUnknown *pDevice
-		m_hwnd, // [in]   HWND hWnd
-		&desc, // [in]   const DXGI_SWAP_CHAIN_DESC1 *pDesc
-		nullptr, // [in]   const DXGI_SWAP_CHAIN_FULLSCREEN_DESC *pFullscreenDesc
-		nullptr, // [in]   IDXGIOutput *pRestrictToOutput
-		m_swapChain.ReleaseAndGetAddressOf()); // [out]  IDXGISwapChain1 **ppSwapChain
+	// create() warned already
+	const bool created = m_swapChain.create(m_hwnd, m_presentOptions);
+	invalidateBuffers();
+	return created;
+}
 
-	if (FAILED(hr)) {
-		qWarning("%s: Could not create swap chain: %#lx", __FUNCTION__, hr);
-		assert(false);
-	}
+void Direct2DWidget::invalidateBuffers()
+{
+	m_fullRepaintsPending = int(qMax(1u, m_swapChain.bufferCount()));
+	m_dirtyHistory.clear();
 }
 
 bool Direct2DWidget::init()
@@ -2,9 +2,12 @@
 #include <QSharedPointer>
 #include "direct2ddevicecontext.h"
 #include "direct2dengine.h"
+#include "direct2dswapchain.h"
 #include "directcontext.h"
+#include "direct2dtiledrecorder.h"
 #include "qwidget.h"
 #include <qglobal.h>
+#include <vector>
 
 using Microsoft::WRL::ComPtr;
 
@@ -18,16 +21,36 @@ public:
 	QScopedPointer<Direct2DPaintEngine> engine;
 	bool init();
 	void flush();
+	inline Direct2DTiledRecorder& tiledRecorder() { return m_tiledRecorder; }
+	// For use from paintEvent: records paint tile by tile on tiledRecorder()'s thread pool,
+	// then composites the tiles in order through painter.
+	void paintTiled(QPainter& painter, const Direct2DTiledRecorder::PaintFunction& paint);
+	// share of the back buffer repainted and presented by the last paint event, 1 for full frames
+	inline qreal dirtyAreaRatio() const { return m_dirtyAreaRatio; }
+	// Recreates the swap chain, FlipDiscard turns off partial presents.
+	void setPresentOptions(const Direct2DPresentOptions& options);
+	inline const Direct2DPresentOptions& presentOptions() const { return m_presentOptions; }
 
 protected:
 	virtual void resizeEvent(QResizeEvent* event) override;
 	bool event(QEvent* event) override;
 	bool nativeEvent(const QByteArray& eventType, void* message, qintptr* result) override;
-	void setupSwapChain();
+	// false when the chain could not be created, nothing is painted until a later call works
+	bool setupSwapChain();
 	void resizeSwapChain(const QSize& size);
 	HWND m_hwnd;
-	ComPtr<IDXGISwapChain1> m_swapChain;
+	Direct2DSwapChain m_swapChain;
+	Direct2DPresentOptions m_presentOptions;
 	bool m_deviceInitialized;
+	Direct2DTiledRecorder m_tiledRecorder;
+	// full frames still needed until every back buffer of the chain was painted once
+	int m_fullRepaintsPending;
+	// rects painted by the last bufferCount() - 1 frames, newest last: a back buffer misses
+	// everything painted since it was presented
+	std::vector<QRect> m_dirtyHistory;
+	void invalidateBuffers();
+	qreal m_dirtyAreaRatio;
 	void recreateTarget() override;
 	void present();
+	void present(const QRect& dirtyRect);
 };
@@ -9,7 +9,6 @@ Direct2DWindow::Direct2DWindow(QWindow* parent)
 	engine.reset();
 	m_hwnd = reinterpret_cast<HWND>(winId());
 	m_context = nullptr;
-	m_swapChain = nullptr;
 
 	setupSwapChain();
 
@@ -104,28 +103,25 @@ int Direct2DWindow::metric(PaintDeviceMetric metric) const
 	return -1;
 }
 
-void Direct2DWindow::setupSwapChain()
+bool Direct2DWindow::setupSwapChain()
 {
-	DXGI_SWAP_CHAIN_DESC1 desc = {};
-
-	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-	desc.SampleDesc.Count = 1;
-	desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	desc.BufferCount = 1;
-	desc.SwapEffect = DXGI_SWAP_EFFECT_SEQUENTIAL;
-
-	HRESULT hr = DirectContext::instance().dxgiFactory()->CreateSwapChainForHwnd(
-		DirectContext::instance().d3dDevice(), // [in]   IUnknown *pDevice
-		m_hwnd,                                // [in]   HWND hWnd
-		&desc,                                 // [in]   const DXGI_SWAP_CHAIN_DESC1 *pDesc
-		nullptr, // [in]   const DXGI_SWAP_CHAIN_FULLSCREEN_DESC *pFullscreenDesc
-		nullptr, // [in]   IDXGIOutput *pRestrictToOutput
-		m_swapChain.ReleaseAndGetAddressOf()); // [out]  IDXGISwapChain1 **ppSwapChain
+	// create() warned already
+	return m_swapChain.create(m_hwnd, m_presentOptions);
+}
 
-	if (FAILED(hr)) {
-		qWarning("%s: Could not create swap chain: %#lx", __FUNCTION__, hr);
-		assert(false);
-	}
+void Direct2DWindow::setPresentOptions(const Direct2DPresentOptions& options)
+{
+	m_presentOptions = options;
+	if (!m_deviceInitialized)
+		return;
+
+	// the old chain's buffers have to be released before the window gets a new one
+	m_context->SetTarget(nullptr);
+	if (!setupSwapChain())
+		return;
+	const qreal dpr = devicePixelRatio();
+	resizeSwapChain(QSize(qRound(width() * dpr), qRound(height() * dpr)));
+	requestUpdate();
 }
 
 void Direct2DWindow::resizeSwapChain(const QSize& size)
@@ -135,16 +131,12 @@ void Direct2DWindow::resizeSwapChain(const QSize& size)
 		if (!m_swapChain)
 			return;
 
-		HRESULT hr = m_swapChain->ResizeBuffers(0,
-			UINT(size.width()),
-			UINT(size.height()),
-			DXGI_FORMAT_UNKNOWN,
-			0);
+		HRESULT hr = m_swapChain.resize(size);
 		if (FAILED(hr))
 			qWarning("%s: Could not resize swap chain: %#lx", __FUNCTION__, hr);
 
 		ComPtr<IDXGISurface1> backBufferSurface;
-		hr = m_swapChain->GetBuffer(0, IID_PPV_ARGS(&backBufferSurface));
+		hr = m_swapChain.get()->GetBuffer(0, IID_PPV_ARGS(&backBufferSurface));
 		if (FAILED(hr)) {
 			qWarning("%s: Could not query backbuffer for DXGI Surface: %#lx", __FUNCTION__, hr);
 			return;
@@ -166,6 +158,8 @@ void Direct2DWindow::resizeSwapChain(const QSize& size)
 void Direct2DWindow::recreateTarget()
 {
 	if (m_deviceInitialized) {
+		// a window holds a single flip model chain, drop the old buffers first
+		m_context->SetTarget(nullptr);
 		setupSwapChain();
 		HRESULT hr = DirectContext::instance()
 			.d2dDevice()
@@ -186,7 +180,7 @@ void Direct2DWindow::recreateTarget()
 
 void Direct2DWindow::present()
 {
-	std::ignore = m_swapChain->Present(0, 0);
+	std::ignore = m_swapChain.present();
 }
 
 void Direct2DWindow::resizeEvent(QResizeEvent* event)
@@ -200,6 +194,10 @@ void Direct2DWindow::resizeEvent(QResizeEvent* event)
 bool Direct2DWindow::event(QEvent* event)
 {
 	if (event->type() == QEvent::UpdateRequest || event->type() == QEvent::Paint) {
+		// no swap chain to paint into, setPresentOptions() or a recreated target may bring it back
+		if (!m_swapChain)
+			return true;
+		m_swapChain.waitForNextFrame();
 		onPaint();
 		present();
 		return true;
@@ -4,19 +4,22 @@
 #include <QSharedPointer>
 #include "direct2ddevicecontext.h"
 #include "direct2dengine.h"
+#include "direct2dswapchain.h"
 #include "directcontext.h"
 
 class Direct2DWindow : public QWindow, public QPaintDevice, public IDirect2DDeviceContext
 {
 private:
 	HWND m_hwnd;
-	ComPtr<IDXGISwapChain1> m_swapChain;
+	Direct2DSwapChain m_swapChain;
+	Direct2DPresentOptions m_presentOptions;
 	bool m_deviceInitialized;
 	QScopedPointer<Direct2DPaintEngine> engine;
 
 protected:
 	int metric(PaintDeviceMetric metric) const override;
-	void setupSwapChain();
+	// false when the chain could not be created, nothing is painted until a later call works
+	bool setupSwapChain();
 	void resizeSwapChain(const QSize& size);
 	void recreateTarget() override;
 	void present();
@@ -30,6 +33,8 @@ public:
 	void onPaint();
 	bool init();
 	void flush();
+	void setPresentOptions(const Direct2DPresentOptions& options);
+	inline const Direct2DPresentOptions& presentOptions() const { return m_presentOptions; }
 
 	// QObject interface
 };
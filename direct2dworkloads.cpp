@@ -0,0 +1,417 @@
+#include "direct2dworkloads.h"
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainterPath>
+#include <QPixmap>
+#include <QRandomGenerator>
+#include <QThread>
+#include <QtMath>
+#include <array>
+#include <memory>
+#include <vector>
+#include "src/direct2d/direct2dcommandbuffer.h"
+#include "src/direct2d/direct2dtiledrecorder.h"
+
+// every workload draws from its own fixed seed, so each frame is identical on every backend
+static const quint32 WORKLOAD_SEED = 0x2d2d;
+
+Direct2DWorkload Direct2DWorkloads::lineGrid()
+{
+	return { QStringLiteral("lineGrid"), [](QPainter& painter, const QSize& size) {
+		QList<QLineF> lines;
+		for (int x = 0; x <= size.width(); x += 4)
+			lines.append(QLineF(x, 0, x, size.height()));
+		for (int y = 0; y <= size.height(); y += 4)
+			lines.append(QLineF(0, y, size.width(), y));
+		painter.setPen(QPen(QColor(40, 40, 40), 1));
+		painter.drawLines(lines);
+	} };
+}
+
+Direct2DWorkload Direct2DWorkloads::rectFills()
+{
+	return { QStringLiteral("rectFills"), [](QPainter& painter, const QSize& size) {
+		QRandomGenerator random(WORKLOAD_SEED);
+		painter.setPen(Qt::NoPen);
+		for (int i = 0; i < 10000; ++i) {
+			const QRectF rect(random.bounded(size.width()), random.bounded(size.height()),
+				4 + random.bounded(60), 4 + random.bounded(60));
+			painter.fillRect(rect, QColor::fromRgb(random.generate() | 0xff000000));
+		}
+	} };
+}
+
+Direct2DWorkload Direct2DWorkloads::textLabels()
+{
+	return { QStringLiteral("textLabels"), [](QPainter& painter, const QSize& size) {
+		QRandomGenerator random(WORKLOAD_SEED);
+		painter.setFont(QFont(QStringLiteral("Segoe UI"), 9));
+		painter.setPen(Qt::black);
+		for (int i = 0; i < 2000; ++i)
+			painter.drawText(QPointF(random.bounded(size.width()), random.bounded(size.height())),
+				QStringLiteral("label %1").arg(i % 500));
+	} };
+}
+
+Direct2DWorkload Direct2DWorkloads::complexPaths()
+{
+	return { QStringLiteral("complexPaths"), [](QPainter& painter, const QSize& size) {
+		QRandomGenerator random(WORKLOAD_SEED);
+		painter.setRenderHint(QPainter::Antialiasing);
+		painter.setPen(QPen(Qt::darkBlue, 1.5));
+		painter.setBrush(QColor(80, 140, 220, 120));
+		for (int i = 0; i < 200; ++i) {
+			QPainterPath path;
+			const QPointF center(random.bounded(size.width()), random.bounded(size.height()));
+			const qreal radius = 10 + random.bounded(60);
+			path.moveTo(center + QPointF(radius, 0));
+			for (int k = 1; k <= 24; ++k) {
+				const qreal angle = k * M_PI / 12;
+				const qreal r = (k % 2 ? 0.5 : 1.0) * radius;
+				path.quadTo(center + QPointF(radius * qCos(angle - 0.1), radius * qSin(angle - 0.1)),
+					center + QPointF(r * qCos(angle), r * qSin(angle)));
+			}
+			path.closeSubpath();
+			painter.drawPath(path);
+		}
+	} };
+}
+
+Direct2DWorkload Direct2DWorkloads::imageBlits()
+{
+	// created once, repeated frames hit the bitmap cache the way a real application would
+	QImage image(64, 64, QImage::Format_ARGB32_Premultiplied);
+	QRandomGenerator random(WORKLOAD_SEED);
+	for (int y = 0; y < image.height(); ++y) {
+		QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < image.width(); ++x)
+			line[x] = random.generate() | 0xff000000;
+	}
+
+	return { QStringLiteral("imageBlits"), [image](QPainter& painter, const QSize& size) {
+		QRandomGenerator random(WORKLOAD_SEED);
+		for (int i = 0; i < 2000; ++i)
+			painter.drawImage(QPointF(random.bounded(size.width()), random.bounded(size.height())),
+				image);
+	} };
+}
+
+Direct2DWorkload Direct2DWorkloads::tiledPixmaps()
+{
+	QPixmap pixmap(32, 32);
+	pixmap.fill(Qt::white);
+	{
+		QPainter p(&pixmap);
+		p.fillRect(0, 0, 16, 16, Qt::gray);
+		p.fillRect(16, 16, 16, 16, Qt::gray);
+	}
+
+	return { QStringLiteral("tiledPixmaps"), [pixmap](QPainter& painter, const QSize& size) {
+		for (int i = 0; i < 50; ++i)
+			painter.drawTiledPixmap(QRect(QPoint(0, 0), size), pixmap, QPoint(i, i));
+	} };
+}
+
+Direct2DWorkload Direct2DWorkloads::textLabels10k(const LabelBatchFunction& batch)
+{
+	// built once by prepare, the timed frames only draw them
+	auto labels = std::make_shared<std::vector<Direct2DTextLabel>>();
+	return { batch ? QStringLiteral("textLabels10kBatch") : QStringLiteral("textLabels10k"),
+		[batch, labels](QPainter& painter, const QSize&) {
+			if (batch && batch(painter, labels->data(), int(labels->size())))
+				return;
+			for (const Direct2DTextLabel& label : *labels) {
+				painter.setFont(label.font);
+				painter.setPen(label.color);
+				painter.drawText(label.position, label.text);
+			}
+		},
+		[labels](const QSize& size) {
+			QRandomGenerator random(WORKLOAD_SEED);
+			const QFont font(QStringLiteral("Segoe UI"), 8);
+			const QColor colors[] = { Qt::black, Qt::darkRed, Qt::darkBlue };
+			labels->resize(10000);
+			for (size_t i = 0; i < labels->size(); ++i) {
+				Direct2DTextLabel& label = (*labels)[i];
+				label.position = QPointF(random.bounded(size.width()), random.bounded(size.height()));
+				label.text = QString::number(random.bounded(100000) / 100.0, 'f', 2);
+				label.font = font;
+				label.color = colors[i % 3];
+			}
+		} };
+}
+
+Direct2DWorkload Direct2DWorkloads::polygons100k()
+{
+	struct shape
+	{
+		QPointF origin;
+		qreal size;
+	};
+	// built once by prepare, the timed frames only draw them
+	auto shapes = std::make_shared<std::vector<shape>>();
+	return { QStringLiteral("polygons100k"),
+		[shapes](QPainter& painter, const QSize&) {
+			painter.setRenderHint(QPainter::Antialiasing);
+			painter.setPen(QPen(QColor(20, 20, 20), 0.5));
+			painter.setBrush(QColor(60, 160, 90));
+			for (size_t i = 0; i < shapes->size(); ++i) {
+				const QPointF origin = (*shapes)[i].origin;
+				const qreal s = (*shapes)[i].size;
+				switch (i % 4) {
+				case 0: {
+					const QPointF triangle[] = { origin, origin + QPointF(s, 0), origin + QPointF(0, s) };
+					painter.drawConvexPolygon(triangle, 3);
+				} break;
+				case 1: {
+					const QPoint o = origin.toPoint();
+					const int is = int(s);
+					const QPoint quad[] = { o, o + QPoint(is, 0), o + QPoint(is, is), o + QPoint(0, is) };
+					painter.drawConvexPolygon(quad, 4);
+				} break;
+				case 2: {
+					const QPointF quad[] = { origin, origin + QPointF(s, s / 3),
+						origin + QPointF(s / 2, s), origin + QPointF(-s / 3, s / 2) };
+					painter.drawPolygon(quad, 4, Qt::WindingFill);
+				} break;
+				default: {
+					const QPointF zigzag[] = { origin, origin + QPointF(s, 0), origin + QPointF(0, s),
+						origin + QPointF(s, s) };
+					painter.drawPolyline(zigzag, 4);
+				} break;
+				}
+			}
+		},
+		[shapes](const QSize& size) {
+			QRandomGenerator random(WORKLOAD_SEED);
+			shapes->resize(100000);
+			for (shape& s : *shapes) {
+				s.origin = QPointF(random.bounded(size.width()), random.bounded(size.height()));
+				s.size = 3 + random.bounded(8);
+			}
+		} };
+}
+
+Direct2DWorkload Direct2DWorkloads::bubbles100k(const EllipseBatchFunction& batch)
+{
+	// one batch of 25000 rects per size, built once by prepare
+	auto rects = std::make_shared<std::array<std::vector<QRectF>, 4>>();
+	return { batch ? QStringLiteral("bubbles100kBatch") : QStringLiteral("bubbles100k"),
+		[batch, rects](QPainter& painter, const QSize&) {
+			const QColor colors[] = { QColor(30, 120, 200, 160), QColor(200, 90, 40, 160),
+				QColor(60, 170, 80, 160), QColor(150, 60, 170, 160) };
+			painter.setRenderHint(QPainter::Antialiasing);
+			for (size_t k = 0; k < rects->size(); ++k) {
+				const std::vector<QRectF>& sized = (*rects)[k];
+				painter.setPen(QPen(colors[k].darker(), 1));
+				painter.setBrush(colors[k]);
+				if (batch && batch(painter, sized.data(), int(sized.size())))
+					continue;
+				for (const QRectF& rect : sized)
+					painter.drawEllipse(rect);
+			}
+		},
+		[rects](const QSize& size) {
+			QRandomGenerator random(WORKLOAD_SEED);
+			const qreal diameters[] = { 4, 6, 9, 14 };
+			for (size_t k = 0; k < rects->size(); ++k) {
+				std::vector<QRectF>& sized = (*rects)[k];
+				sized.resize(25000);
+				for (QRectF& rect : sized)
+					rect = QRectF(random.bounded(size.width()), random.bounded(size.height()),
+						diameters[k], diameters[k]);
+			}
+		} };
+}
+
+Direct2DWorkload Direct2DWorkloads::heatmapCells(const RectFillFunction& batch)
+{
+	struct cells
+	{
+		std::vector<QRectF> rects;
+		std::vector<QColor> colors;
+	};
+	// built once by prepare, the timed frames only fill them
+	auto heatmap = std::make_shared<cells>();
+	return { batch ? QStringLiteral("heatmapCellsBatch") : QStringLiteral("heatmapCells"),
+		[batch, heatmap](QPainter& painter, const QSize&) {
+			const std::vector<QRectF>& rects = heatmap->rects;
+			const std::vector<QColor>& colors = heatmap->colors;
+			if (batch && batch(painter, rects.data(), colors.data(), int(rects.size())))
+				return;
+			for (size_t i = 0; i < rects.size(); ++i)
+				painter.fillRect(rects[i], colors[i]);
+		},
+		[heatmap](const QSize& size) {
+			heatmap->rects.clear();
+			heatmap->colors.clear();
+			for (int y = 0; y < size.height(); y += 4) {
+				for (int x = 0; x < size.width(); x += 4) {
+					const qreal value = 0.5 + 0.25 * (qSin(x * 0.02) + qCos(y * 0.03));
+					heatmap->rects.push_back(QRectF(x, y, 4, 4));
+					heatmap->colors.push_back(QColor::fromHsvF(0.66 * (1.0 - value), 0.9, 0.9));
+				}
+			}
+		} };
+}
+
+Direct2DWorkload Direct2DWorkloads::tiledRecording(int threads)
+{
+	struct scene
+	{
+		std::vector<QPointF> origins;
+		Direct2DTiledRecorder recorder;
+	};
+	// the triangles are built once by prepare, the timed frames record and replay them
+	auto shared = std::make_shared<scene>();
+	shared->recorder.setThreadCount(threads);
+	return { QStringLiteral("tiledRecording%1").arg(threads),
+		[shared](QPainter& painter, const QSize& size) {
+			const std::vector<QPointF>& origins = shared->origins;
+			shared->recorder.record(size, [&origins](QPainter& tilePainter, const QRect& tile) {
+				tilePainter.setRenderHint(QPainter::Antialiasing);
+				tilePainter.setPen(Qt::NoPen);
+				tilePainter.setBrush(QColor(200, 90, 40, 160));
+				// triangles are at most 10 px large, the ones outside the tile are skipped
+				const QRectF bounds = QRectF(tile).adjusted(-10, -10, 0, 0);
+				for (const QPointF& origin : origins) {
+					if (!bounds.contains(origin))
+						continue;
+					const QPointF triangle[] = { origin, origin + QPointF(10, 0), origin + QPointF(0, 10) };
+					tilePainter.drawConvexPolygon(triangle, 3);
+				}
+			});
+			shared->recorder.replay(painter);
+		},
+		[shared](const QSize& size) {
+			QRandomGenerator random(WORKLOAD_SEED);
+			shared->origins.resize(50000);
+			for (QPointF& origin : shared->origins)
+				origin = QPointF(random.bounded(size.width()), random.bounded(size.height()));
+		} };
+}
+
+QList<Direct2DWorkload> Direct2DWorkloads::tiledScaling()
+{
+	QList<Direct2DWorkload> workloads;
+	for (int threads = 1; threads <= QThread::idealThreadCount(); ++threads)
+		workloads.append(tiledRecording(threads));
+	return workloads;
+}
+
+QList<Direct2DWorkload> Direct2DWorkloads::standard()
+{
+	return { lineGrid(), rectFills(), textLabels(), complexPaths(), imageBlits(), tiledPixmaps(),
+		textLabels10k(), polygons100k(), bubbles100k(), heatmapCells() };
+}
+
+Direct2DWorkloadRunner::Direct2DWorkloadRunner(const QSize& size, int frames)
+	: m_size(size)
+	, m_frames(frames)
+	, m_warmupFrames(2)
+{}
+
+Direct2DWorkloadResult Direct2DWorkloadRunner::run(const Direct2DWorkload& workload,
+	QPaintDevice* device,
+	const QString& backend,
+	const DrawCallCounter& drawCalls) const
+{
+	Direct2DWorkloadResult result;
+	result.workload = workload.name;
+	result.backend = backend;
+
+	// the recording device keeps appending to its buffer, start every frame empty
+	auto* recording = dynamic_cast<Direct2DRecordingDevice*>(device);
+	auto paintFrame = [&]() {
+		if (recording)
+			recording->commands().clear();
+		QPainter painter(device);
+		workload.paint(painter, m_size);
+	};
+
+	if (workload.prepare)
+		workload.prepare(m_size);
+	for (int i = 0; i < m_warmupFrames; ++i)
+		paintFrame();
+
+	const quint64 allocationsBefore = m_allocations ? m_allocations() : 0;
+	QElapsedTimer timer;
+	timer.start();
+	for (int i = 0; i < m_frames; ++i)
+		paintFrame();
+	const qint64 elapsed = timer.nsecsElapsed();
+	const quint64 allocationsAfter = m_allocations ? m_allocations() : 0;
+
+	result.frames = m_frames;
+	result.nsPerFrame = m_frames > 0 ? elapsed / m_frames : 0;
+	if (drawCalls)
+		result.drawCalls = drawCalls();
+	if (m_allocations && m_frames > 0)
+		result.allocationsPerFrame = qint64(allocationsAfter - allocationsBefore) / m_frames;
+	return result;
+}
+
+QList<Direct2DWorkloadResult> Direct2DWorkloadRunner::run(const QList<Direct2DWorkload>& workloads,
+	QPaintDevice* device,
+	const QString& backend,
+	const DrawCallCounter& drawCalls) const
+{
+	QList<Direct2DWorkloadResult> results;
+	for (const Direct2DWorkload& workload : workloads)
+		results.append(run(workload, device, backend, drawCalls));
+	return results;
+}
+
+QList<Direct2DWorkloadResult> Direct2DWorkloadRunner::runRaster(
+	const QList<Direct2DWorkload>& workloads) const
+{
+	QImage image(m_size, QImage::Format_ARGB32_Premultiplied);
+	image.fill(Qt::white);
+	return run(workloads, &image, QStringLiteral("raster"));
+}
+
+QList<Direct2DWorkloadResult> Direct2DWorkloadRunner::runRecording(
+	const QList<Direct2DWorkload>& workloads) const
+{
+	Direct2DRecordingDevice device(m_size);
+	return run(workloads, &device, QStringLiteral("recording"), [&device]() {
+		return qint64(device.commands().commandCount());
+	});
+}
+
+QString Direct2DWorkloadRunner::report(const QList<Direct2DWorkloadResult>& results)
+{
+	QStringList workloads;
+	QStringList backends;
+	for (const Direct2DWorkloadResult& result : results) {
+		if (!workloads.contains(result.workload))
+			workloads.append(result.workload);
+		if (!backends.contains(result.backend))
+			backends.append(result.backend);
+	}
+
+	QString text = QStringLiteral("%1").arg(QStringLiteral("workload"), -20);
+	for (const QString& backend : std::as_const(backends))
+		text += QStringLiteral("%1").arg(backend + QStringLiteral(" ms (calls) [allocs]"), 32);
+	text += QLatin1Char('\n');
+
+	for (const QString& workload : std::as_const(workloads)) {
+		text += QStringLiteral("%1").arg(workload, -20);
+		for (const QString& backend : std::as_const(backends)) {
+			QString cell = QStringLiteral("-");
+			for (const Direct2DWorkloadResult& result : results) {
+				if (result.workload != workload || result.backend != backend)
+					continue;
+				cell = QString::number(result.nsPerFrame / 1e6, 'f', 3);
+				if (result.drawCalls >= 0)
+					cell += QStringLiteral(" (%1)").arg(result.drawCalls);
+				if (result.allocationsPerFrame >= 0)
+					cell += QStringLiteral(" [%1]").arg(result.allocationsPerFrame);
+				break;
+			}
+			text += QStringLiteral("%1").arg(cell, 32);
+		}
+		text += QLatin1Char('\n');
+	}
+	return text;
+}
@@ -0,0 +1,125 @@
+#ifndef DIRECT2DWORKLOADS_H
+#define DIRECT2DWORKLOADS_H
+
+#include <QList>
+#include <QPaintDevice>
+#include <QPainter>
+#include <QString>
+#include <functional>
+#include "src/direct2d/direct2dtextlabel.h"
+
+// Reproducible QPainter workloads for comparing paint devices. Everything here only depends on
+// QtGui: a workload can be timed on a Direct2DBitmap, on a Direct2DRecordingDevice (which
+// also runs where there is no Direct2D) and on a QImage, the raster engine baseline.
+struct Direct2DWorkload
+{
+	using PaintFunction = std::function<void(QPainter& painter, const QSize& size)>;
+	using PrepareFunction = std::function<void(const QSize& size)>;
+
+	QString name;
+	PaintFunction paint;
+	// builds the inputs of paint for a device size, called before any frame is painted
+	PrepareFunction prepare;
+};
+
+struct Direct2DWorkloadResult
+{
+	QString workload;
+	QString backend;
+	int frames = 0;
+	qint64 nsPerFrame = 0;
+	// device draw calls of the last frame, -1 when the backend cannot tell
+	qint64 drawCalls = -1;
+	// heap allocations per timed frame, -1 without an allocation counter
+	qint64 allocationsPerFrame = -1;
+};
+
+namespace Direct2DWorkloads {
+	Direct2DWorkload lineGrid();
+	Direct2DWorkload rectFills();
+	Direct2DWorkload textLabels();
+	Direct2DWorkload complexPaths();
+	Direct2DWorkload imageBlits();
+	Direct2DWorkload tiledPixmaps();
+
+	// Draws a whole batch of items in one call, returns false to let the workload fall back to
+	// one QPainter call per item. The static Direct2DPaintEngine overloads taking a QPainter&
+	// (drawTextRuns, drawEllipses, fillRects) fit.
+	template<class... Items>
+	using BatchFunction = std::function<bool(QPainter& painter, const Items*... items, int count)>;
+
+	using LabelBatchFunction = BatchFunction<Direct2DTextLabel>;
+	// 10k short chart labels, drawn through batch when given, per call otherwise
+	Direct2DWorkload textLabels10k(const LabelBatchFunction& batch = LabelBatchFunction());
+	// 100k small triangles and quads through drawPolygon/drawConvexPolygon, integer and
+	// floating point, a quarter of them axis aligned squares
+	Direct2DWorkload polygons100k();
+
+	using EllipseBatchFunction = BatchFunction<QRectF>;
+	// bubble chart of 100k circles in four sizes, one batch per size
+	Direct2DWorkload bubbles100k(const EllipseBatchFunction& batch = EllipseBatchFunction());
+
+	// one color per rect
+	using RectFillFunction = BatchFunction<QRectF, QColor>;
+	// 4 px heatmap cells covering the device, one color per cell
+	Direct2DWorkload heatmapCells(const RectFillFunction& batch = RectFillFunction());
+
+	// 50k triangles recorded tile by tile through a Direct2DTiledRecorder on threads threads,
+	// then replayed onto the painter
+	Direct2DWorkload tiledRecording(int threads);
+	// tiledRecording(1) up to tiledRecording(QThread::idealThreadCount()), to see how recording
+	// scales with threads
+	QList<Direct2DWorkload> tiledScaling();
+
+	// all of the above in this order, without batch functions and thread scaling
+	QList<Direct2DWorkload> standard();
+}
+
+class Direct2DWorkloadRunner
+{
+public:
+	// Returns the draw calls of the frame just painted, e.g. from Direct2DPaintEngine::frameStats().
+	using DrawCallCounter = std::function<qint64()>;
+	// Returns the heap allocations made so far by the process, e.g. from a counting operator new.
+	using AllocationCounter = std::function<quint64()>;
+
+private:
+	QSize m_size;
+	int m_frames;
+	int m_warmupFrames;
+	AllocationCounter m_allocations;
+
+public:
+	explicit Direct2DWorkloadRunner(const QSize& size = QSize(1024, 768), int frames = 20);
+
+	inline QSize size() const { return m_size; }
+	inline void setFrames(int frames) { m_frames = frames; }
+	inline int frames() const { return m_frames; }
+	// untimed frames painted first, they fill the device caches
+	inline void setWarmupFrames(int frames) { m_warmupFrames = frames; }
+	inline int warmupFrames() const { return m_warmupFrames; }
+	// sampled around the timed frames of every run
+	inline void setAllocationCounter(const AllocationCounter& counter) { m_allocations = counter; }
+
+	// device must be at least size() large
+	Direct2DWorkloadResult run(const Direct2DWorkload& workload,
+		QPaintDevice* device,
+		const QString& backend,
+		const DrawCallCounter& drawCalls = DrawCallCounter()) const;
+	QList<Direct2DWorkloadResult> run(const QList<Direct2DWorkload>& workloads,
+		QPaintDevice* device,
+		const QString& backend,
+		const DrawCallCounter& drawCalls = DrawCallCounter()) const;
+	// QImage with the raster engine, the baseline
+	QList<Direct2DWorkloadResult> runRaster(const QList<Direct2DWorkload>& workloads) const;
+	// Direct2DRecordingDevice, draw calls are the recorded commands. The recording device has
+	// its own paint engine, so this measures QPainter call overhead and command counts only,
+	// nothing of Direct2DPaintEngine's batching or caches: there is no IDirect2DDeviceContext
+	// stand-in the engine could draw into without a Direct2D device.
+	QList<Direct2DWorkloadResult> runRecording(const QList<Direct2DWorkload>& workloads) const;
+
+	// One line per workload, one column per backend, in the order they first appear.
+	static QString report(const QList<Direct2DWorkloadResult>& results);
+};
+
+#endif // DIRECT2DWORKLOADS_H
@@ -0,0 +1,109 @@
+// Command line runner of the standard workloads: prints one row per workload with the time per
+// frame, the draw calls and the heap allocations per frame of every backend. Build it as its own
+// executable together with direct2dworkloads.cpp and direct2dcommandbuffer.cpp (and the
+// Direct2D sources on Windows); the counting operator new below must not end up in a library.
+#include <QGuiApplication>
+#include <QTextStream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "src/direct2d/direct2dworkloads.h"
+#ifdef Q_OS_WIN
+#include "src/direct2d/direct2dbitmap.h"
+#include "src/direct2d/direct2dengine.h"
+#include "src/direct2d/directcontext.h"
+#endif
+
+static std::atomic<quint64> g_allocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+int main(int argc, char* argv[])
+{
+	QGuiApplication app(argc, argv);
+
+	Direct2DWorkloadRunner runner;
+	runner.setAllocationCounter([]() { return g_allocations.load(std::memory_order_relaxed); });
+
+	QList<Direct2DWorkload> workloads = Direct2DWorkloads::standard();
+	workloads += Direct2DWorkloads::tiledScaling();
+	QList<Direct2DWorkloadResult> results = runner.runRaster(workloads);
+	results += runner.runRecording(workloads);
+
+#ifdef Q_OS_WIN
+	// the batched variants only differ from the plain ones on the Direct2D engine
+	workloads += Direct2DWorkloads::textLabels10k(
+		[](QPainter& painter, const Direct2DTextLabel* labels, int labelCount) {
+			return Direct2DPaintEngine::drawTextRuns(painter, labels, labelCount);
+		});
+	workloads += Direct2DWorkloads::bubbles100k(
+		[](QPainter& painter, const QRectF* rects, int rectCount) {
+			return Direct2DPaintEngine::drawEllipses(painter, rects, rectCount);
+		});
+	workloads += Direct2DWorkloads::heatmapCells(
+		[](QPainter& painter, const QRectF* rects, const QColor* colors, int rectCount) {
+			return Direct2DPaintEngine::fillRects(painter, rects, colors, rectCount);
+		});
+
+	Direct2DBitmap bitmap;
+	if (DirectContext::instance().init()
+		&& bitmap.init(UINT32(runner.size().width()), UINT32(runner.size().height()))) {
+		auto* engine = static_cast<Direct2DPaintEngine*>(bitmap.paintEngine());
+		results += runner.run(workloads, &bitmap, QStringLiteral("direct2d"), [engine]() {
+			return Direct2DPaintEngine::hasFrameStats() ? qint64(engine->frameStats().totalDrawCalls())
+														: qint64(-1);
+		});
+
+		// drawLines is one engine call whichever path strokes it, count the device submissions
+		// to tell the batched lines from the unbatched ones
+		const auto lineSubmissions = [engine]() {
+			const Direct2DFrameStats& stats = engine->frameStats();
+			return Direct2DPaintEngine::hasFrameStats()
+				? qint64(stats.lineSubmissions) + qint64(stats.lineBatchSubmissions)
+				: qint64(-1);
+		};
+		const Direct2DWorkload lineGrid = Direct2DWorkloads::lineGrid();
+		results += runner.run(lineGrid, &bitmap, QStringLiteral("direct2d lines"), lineSubmissions);
+		const int lineBatchThreshold = engine->lineBatchThreshold();
+		engine->setLineBatchThreshold(0);
+		results += runner.run(lineGrid, &bitmap, QStringLiteral("direct2d unbatched"), lineSubmissions);
+		engine->setLineBatchThreshold(lineBatchThreshold);
+	} else {
+		qWarning("%s: No Direct2D device, skipping the direct2d backend", __FUNCTION__);
+	}
+#endif
+
+	QTextStream(stdout) << Direct2DWorkloadRunner::report(results);
+	return 0;
+}
@@ -1,7 +1,7 @@
 #include "directcontext.h"
 #include "qlogging.h"
 #include  <dxgi1_5.h>
-bool DirectContext::init()
+bool DirectContext::init(bool software)
 {
 	HRESULT hr;
 	hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED,
@@ -17,10 +17,12 @@ bool DirectContext::init()
 	D3D_FEATURE_LEVEL feature[] = { D3D_FEATURE_LEVEL_11_0,
 								   D3D_FEATURE_LEVEL_11_1,
 								   D3D_FEATURE_LEVEL_12_0 };
-	D3D_DRIVER_TYPE typeAttempts[] = { D3D_DRIVER_TYPE_HARDWARE };
+	// WARP is the SIMD software rasterizer that ships with Windows, it covers VMs, RDP
+	// sessions and headless machines where no hardware device can be created
+	D3D_DRIVER_TYPE typeAttempts[] = { D3D_DRIVER_TYPE_HARDWARE, D3D_DRIVER_TYPE_WARP };
 	const int ntypes = int(sizeof(typeAttempts) / sizeof(typeAttempts[0]));
 
-	for (int i = 0; i < ntypes; i++) {
+	for (int i = software ? ntypes - 1 : 0; i < ntypes; i++) {
 		hr = D3D11CreateDevice(nullptr,
 			typeAttempts[i],
 			nullptr,
@@ -33,8 +35,14 @@ bool DirectContext::init()
 			reinterpret_cast<ID3D11DeviceContext**>(
 				m_d3ddevicecontext.GetAddressOf()));
 
-		if (SUCCEEDED(hr))
+		if (SUCCEEDED(hr)) {
+			m_driverType = typeAttempts[i];
 			break;
+		}
+		qWarning("%s: Could not create Direct3D Device of driver type %d: %#lx",
+			__FUNCTION__,
+			int(typeAttempts[i]),
+			hr);
 	}
 
 	if (FAILED(hr)) {
@@ -87,4 +95,13 @@ bool DirectContext::init()
 	return true;
 }
 
-DirectContext::DirectContext() {}
+DirectContext::DirectContext()
+	: m_driverType(D3D_DRIVER_TYPE_UNKNOWN)
+	, m_brushCache(512)
+	, m_strokeStyleCache(256)
+	, m_bitmapCache(64 * 1024 * 1024)
+	, m_geometryCache(16 * 1024 * 1024)
+	, m_fontFaceCache(256)
+	, m_glyphRunCache(4 * 1024 * 1024)
+	, m_surfacePool(128 * 1024 * 1024)
+{}
@@ -17,7 +17,148 @@
 #include <windows.h>
 #include <wrl.h>
 #include <dwrite_3.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "src/direct2d/direct2dcachekeys.h"
+#include "src/direct2d/direct2dlrucache.h"
+#include "src/direct2d/direct2dsurfacepool.h"
 using Microsoft::WRL::ComPtr;
+
+using Direct2DBrushCache = Direct2DConcurrentLruCache<Direct2DBrushKey, ComPtr<ID2D1Brush>>;
+using Direct2DStrokeStyleCache = Direct2DConcurrentLruCache<Direct2DStrokeKey, ComPtr<ID2D1StrokeStyle1>>;
+
+// Uploaded images shared by every render thread. A detached QImage/QPixmap keeps the serial
+// number in the high half of its cacheKey, so the index from serial to the key last uploaded
+// for it drops the stale copy in O(1) instead of scanning the cache on every upload.
+class Direct2DBitmapCache
+{
+private:
+	mutable std::mutex m_mutex;
+	Direct2DLruCache<Direct2DBitmapKey, ComPtr<ID2D1Bitmap>> m_cache;
+	// keyed by the key with the detach number cleared
+	std::unordered_map<Direct2DBitmapKey, Direct2DBitmapKey> m_serials;
+
+	static inline Direct2DBitmapKey serialKey(Direct2DBitmapKey key)
+	{
+		key.cacheKey = qint64(quint64(key.serial()) << 32);
+		return key;
+	}
+
+public:
+	explicit Direct2DBitmapCache(size_t maxCost)
+		: m_cache(maxCost)
+	{}
+
+	std::optional<ComPtr<ID2D1Bitmap>> find(const Direct2DBitmapKey& key)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (ComPtr<ID2D1Bitmap>* bitmap = m_cache.find(key))
+			return *bitmap;
+		return std::nullopt;
+	}
+
+	void insert(const Direct2DBitmapKey& key, ComPtr<ID2D1Bitmap> bitmap, size_t cost)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Direct2DBitmapKey& last = m_serials[serialKey(key)];
+		if (last.cacheKey != 0 && last.cacheKey != key.cacheKey)
+			m_cache.remove(last);
+		last = key;
+		m_cache.insert(key, std::move(bitmap), cost);
+
+		// evictions leave their serials behind, drop them once they outnumber the cached bitmaps
+		if (m_serials.size() > 2 * m_cache.count() + 64) {
+			for (auto it = m_serials.begin(); it != m_serials.end();) {
+				if (m_cache.contains(it->second))
+					++it;
+				else
+					it = m_serials.erase(it);
+			}
+		}
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.clear();
+		m_serials.clear();
+	}
+
+	void setMaxCost(size_t maxCost)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.setMaxCost(maxCost);
+	}
+
+	Direct2DCacheStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cache.stats();
+	}
+
+	void resetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.resetStats();
+	}
+};
+
+struct Direct2DGeometryEntry
+{
+	ComPtr<ID2D1PathGeometry> geometry;
+	// guards everything below, engines on other threads draw the same cached entry
+	std::mutex mutex;
+	// consecutive draws at the same transform scale, used to decide when to realize
+	FLOAT scale = 0.0f;
+	int sameScaleDraws = 0;
+#ifndef __MINGW64__
+	ComPtr<ID2D1GeometryRealization> fill;
+	ComPtr<ID2D1GeometryRealization> stroke;
+	ComPtr<ID2D1StrokeStyle1> strokeStyle;
+	FLOAT strokeWidth = 0.0f;
+#endif
+};
+// entries are handed out as shared pointers, an engine keeps drawing one that another thread evicts
+using Direct2DGeometryCache
+	= Direct2DConcurrentLruCache<Direct2DPathKey, std::shared_ptr<Direct2DGeometryEntry>>;
+
+// Glyphs of a shaped string, laid out to be pointed at by a DWRITE_GLYPH_RUN.
+struct Direct2DGlyphRun
+{
+	std::vector<UINT16> indices;
+	std::vector<FLOAT> advances;
+	std::vector<DWRITE_GLYPH_OFFSET> offsets;
+	FLOAT emSize = 0.0f;
+
+	inline size_t cost() const
+	{
+		return indices.size() * (sizeof(UINT16) + sizeof(FLOAT) + sizeof(DWRITE_GLYPH_OFFSET)) + 128;
+	}
+};
+using Direct2DFontFaceCache = Direct2DConcurrentLruCache<QFont, ComPtr<IDWriteFontFace>>;
+// runs are handed out as shared pointers, an engine keeps drawing one that another thread evicts
+using Direct2DGlyphRunCache
+	= Direct2DConcurrentLruCache<Direct2DGlyphRunKey, std::shared_ptr<const Direct2DGlyphRun>>;
+
+// What a pooled offscreen bitmap was created with, the DPI is baked in at creation.
+struct Direct2DSurfaceFormat
+{
+	DXGI_FORMAT format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	D2D1_BITMAP_OPTIONS options = D2D1_BITMAP_OPTIONS_TARGET;
+	FLOAT dpiX = 96.0f;
+	FLOAT dpiY = 96.0f;
+
+	inline bool operator==(const Direct2DSurfaceFormat& other) const
+	{
+		return format == other.format && options == other.options && dpiX == other.dpiX
+			&& dpiY == other.dpiY;
+	}
+};
+using Direct2DBitmapPool = Direct2DSurfacePool<ComPtr<ID2D1Bitmap1>, Direct2DSurfaceFormat>;
+
 class DirectContext
 {
 private:
@@ -28,8 +169,28 @@ private:
 	ComPtr<ID2D1WRITEFACTORY> m_dwriteFactory;
 	ComPtr<IDXGIFactory7> m_dxgiFactory;
 	ComPtr<IDWriteGdiInterop> m_dwriteInterop;
+	D3D_DRIVER_TYPE m_driverType;
+	// brushes are device resources, every device context created from m_d2dDevice can use them,
+	// on any render thread
+	Direct2DBrushCache m_brushCache;
+	// stroke styles are factory resources, they outlive any device and are shared by every
+	// render thread
+	Direct2DStrokeStyleCache m_strokeStyleCache;
+	// uploaded images, budgeted in bytes of GPU memory, shared by every render thread
+	Direct2DBitmapCache m_bitmapCache;
+	// path geometries and their realizations, budgeted in estimated bytes, shared by every
+	// render thread
+	Direct2DGeometryCache m_geometryCache;
+	// font faces only depend on the DirectWrite factory, they survive device loss and are
+	// shared by every engine and render thread
+	Direct2DFontFaceCache m_fontFaceCache;
+	// shaped strings, budgeted in bytes, shared by every engine and render thread
+	Direct2DGlyphRunCache m_glyphRunCache;
+	// released Direct2DBitmap targets, budgeted in bytes of GPU memory
+	Direct2DBitmapPool m_surfacePool;
 public:
-	bool init();
+	// Tries a hardware device first and falls back to WARP, software skips the hardware attempt.
+	bool init(bool software = false);
 	DirectContext();
 	~DirectContext() = default;
 
@@ -45,6 +206,18 @@ public:
 	inline ID3D11DeviceContext3* d3dDeviceContext() const { return m_d3ddevicecontext.Get(); }
 	inline IDXGIFactory7* dxgiFactory() const { return m_dxgiFactory.Get(); }
 	inline IDWriteGdiInterop* IDWriteGdiInterop() const { return m_dwriteInterop.Get(); }
+	inline D3D_DRIVER_TYPE driverType() const { return m_driverType; }
+	// rendering on the CPU through WARP
+	inline bool isSoftware() const { return m_driverType == D3D_DRIVER_TYPE_WARP; }
+	inline Direct2DBrushCache& brushCache() { return m_brushCache; }
+	inline Direct2DStrokeStyleCache& strokeStyleCache() { return m_strokeStyleCache; }
+	inline Direct2DBitmapCache& bitmapCache() { return m_bitmapCache; }
+	inline Direct2DGeometryCache& geometryCache() { return m_geometryCache; }
+	inline Direct2DFontFaceCache& fontFaceCache() { return m_fontFaceCache; }
+	// glyphRunCache().stats().hitRate() tells how much shaping text drawing avoids
+	inline Direct2DGlyphRunCache& glyphRunCache() { return m_glyphRunCache; }
+	// surfacePool().stats().pooledBytes is the GPU memory parked for reuse, trim() returns it
+	inline Direct2DBitmapPool& surfacePool() { return m_surfacePool; }
 };
 
 [[maybe_unused]] static inline ID2D1FACTORY* factory()